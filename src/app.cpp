@@ -25,8 +25,7 @@ void drawGUI(VkApp& VK)
     // ImGui::Checkbox("Ray Tracer mode", &VK.useRaytracer);
 
     // An example slider:
-    // if (ImGui::SliderFloat("Exposure", &VK.m_pcRay.exposure, 0.5f, 8.0f, "%.5f"))
-    //    VK.m_pcRay.clear = true;
+    // ImGui::SliderFloat("Exposure", &VK.m_pcTonemap.exposure, 0.25f, 4.0f, "%.5f");
 
 }
 
@@ -122,6 +121,32 @@ void key_cb(GLFWwindow* window, int key, int scancode, int action, int mods)
 
     if (pressed && key == GLFW_KEY_ESCAPE)
         glfwSetWindowShouldClose(window, 1);
+
+    // Switch between the denoiser's modes, to compare them
+    if (action == GLFW_PRESS && key == GLFW_KEY_V)
+        app->useSvgf = !app->useSvgf;
+
+    // Tone mapping:  toggle auto-exposure, print the luminance histogram
+    if (action == GLFW_PRESS && key == GLFW_KEY_E)
+        app->autoExposure = !app->autoExposure;
+    if (action == GLFW_PRESS && key == GLFW_KEY_H)
+        app->dumpHistogram = true;
+
+    // Switch between the GPU-driven and per-instance rasters
+    if (action == GLFW_PRESS && key == GLFW_KEY_G)
+        app->gpuDrivenRaster = !app->gpuDrivenRaster;
+    if (action == GLFW_PRESS && key == GLFW_KEY_O)
+        app->occlusionCulling = !app->occlusionCulling;
+    if (action == GLFW_PRESS && key == GLFW_KEY_M)
+        app->meshletRaster = !app->meshletRaster;
+
+    // Switch between deferred and forward shading in the raster
+    if (action == GLFW_PRESS && key == GLFW_KEY_I)
+        app->deferredRaster = !app->deferredRaster;
+
+    // Switch between hybrid rendering and pure path tracing
+    if (action == GLFW_PRESS && key == GLFW_KEY_P)
+        app->hybridPrimary = !app->hybridPrimary;
 }
 
 static float lastTime = 0;
@@ -164,12 +189,75 @@ void App::updateCamera()
 App::App(int argc, char** argv)
 {
     doApiDump = false;
+    samplesPerLaunch = 0;
+    targetFrameMs = 16.0f;
+    useRayQuery = false;
+    useWavefront = false;
+    tileSize = 0;
+    convergenceThreshold = 0.01f;
+    useSvgf = false;
+    renderScale = 1.0f;
+    useSpatialUpscaler = false;
+    dynamicResolution = false;
+    autoExposure = true;
+    useRasterizer = false;
+    gpuDrivenRaster = false;
+    occlusionCulling = true;
+    meshletRaster = false;
+    meshShaders = true;
+    hybridPrimary = false;
+    deferredRaster = false;
+    recordThreads = 1;
+    descriptorBenchmark = false;
+    hashTextures = false;
 
     int argi = 1;
     while (argi<argc) {
         std::string arg = argv[argi++];
         if (arg == "-d")
             doApiDump = true;
+        else if (arg == "-s" && argi<argc)
+            samplesPerLaunch = std::stoi(argv[argi++]);
+        else if (arg == "-t" && argi<argc)
+            targetFrameMs = std::stof(argv[argi++]);
+        else if (arg == "-q")
+            useRayQuery = true;
+        else if (arg == "-w")
+            useWavefront = true;
+        else if (arg == "-T" && argi<argc)
+            tileSize = std::stoi(argv[argi++]);
+        else if (arg == "-e" && argi<argc)
+            convergenceThreshold = std::stof(argv[argi++]);
+        else if (arg == "-v")
+            useSvgf = true;
+        else if (arg == "-r" && argi<argc)
+            renderScale = std::clamp(std::stof(argv[argi++]), 0.25f, 1.0f);
+        else if (arg == "-U")
+            useSpatialUpscaler = true;
+        else if (arg == "-R")
+            dynamicResolution = true;
+        else if (arg == "-E")
+            autoExposure = false;
+        else if (arg == "-S")
+            useRasterizer = true;
+        else if (arg == "-G")
+            gpuDrivenRaster = true;
+        else if (arg == "-O")
+            occlusionCulling = false;
+        else if (arg == "-M")
+            meshletRaster = true;
+        else if (arg == "-F")
+            meshShaders = false;
+        else if (arg == "-P")
+            hybridPrimary = true;
+        else if (arg == "-I")
+            deferredRaster = true;
+        else if (arg == "-j" && argi<argc)
+            recordThreads = std::clamp(std::stoi(argv[argi++]), 1, 64);
+        else if (arg == "-B")
+            descriptorBenchmark = true;
+        else if (arg == "-C")
+            hashTextures = true;
         else {
             printf("Unknown argument: %s\n", arg.c_str());
             exit(-1); } }
@@ -7,6 +7,28 @@ public:
     GLFWwindow* GLFW_window;
     App(int argc, char** argv);
     bool doApiDump;
+    int   samplesPerLaunch;  // -s N: fixed paths per pixel per launch (0: adaptive)
+    float targetFrameMs;     // -t ms: frame time the adaptive sample count aims for
+    bool  useRayQuery;       // -q: trace with the ray query compute backend
+    bool  useWavefront;      // -w: trace with the wavefront path tracer
+    int   tileSize;          // -T N: trace in tiles of NxN pixels (0: whole screen)
+    float convergenceThreshold;  // -e err: relative error at which a pixel stops (0: off)
+    bool  useSvgf;           // -v: variance-guided denoiser (toggled with the V key)
+    float renderScale;       // -r scale: path trace at this fraction of the window size
+    bool  useSpatialUpscaler;  // -U: spatial upscaler in place of TAA
+    bool  dynamicResolution;   // -R: vary the render size (up to -r) to hold -t
+    bool  autoExposure;      // -E: fixed exposure (toggled with the E key)
+    bool  dumpHistogram = false;  // H key: print the next luminance histogram
+    bool  useRasterizer;     // -S: scanline rasterizer in place of the path tracer
+    bool  gpuDrivenRaster;   // -G: cull and draw the raster on the GPU (toggled with the G key)
+    bool  occlusionCulling;  // -O: no occlusion culling in the GPU-driven raster (toggled with the O key)
+    bool  meshletRaster;     // -M: cull meshlets, not meshes, in the GPU-driven raster (toggled with the M key)
+    bool  meshShaders;       // -F: meshlets through the compute culling fallback, even with mesh shaders
+    bool  hybridPrimary;     // -P: rasterize the path tracer's primary hits (toggled with the P key)
+    bool  deferredRaster;    // -I: shade the raster once per pixel from an ID buffer (toggled with the I key)
+    int   recordThreads;     // -j N: record the per-instance raster on N threads (1: inline)
+    bool  descriptorBenchmark;  // -B: time re-pointing the history handles at startup
+    bool  hashTextures;      // -C: share textures by file content, as well as by path
     
     bool m_show_gui = true;
     Camera myCamera;
@@ -55,6 +55,7 @@ void VkApp::initImageWrap(ImageWrap& wrap,
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
     vkCreateImage(m_device, &imageInfo, nullptr, &wrap.image);
+    wrap.extent = size;
 
     // Create and bind the associated VkDeviceMemory
     VkMemoryRequirements memRequirements;
@@ -114,26 +115,19 @@ void VkApp::initImageWrap(ImageWrap& wrap,
     }
 }
 
+// The textures' sampler:  trilinear, anisotropic as far as the device
+// allows, repeating, and over all mip levels.  Shared, as are all
+// samplers;  see vkapp_samplers.cpp.
 void VkApp::initTextureSampler(ImageWrap& wrap)
 {
-    VkPhysicalDeviceProperties properties{};
-    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
-
-    VkSamplerCreateInfo samplerInfo{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-
-    vkCreateSampler(m_device, &samplerInfo, nullptr, &wrap.sampler);
+    SamplerKey key;
+    key.maxAnisotropy = m_deviceProperties.limits.maxSamplerAnisotropy;
+    initTextureSampler(wrap, key);
+}
+
+void VkApp::initTextureSampler(ImageWrap& wrap, const SamplerKey& key)
+{
+    wrap.sampler = acquireSampler(key);
 }
 
 
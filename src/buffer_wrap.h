@@ -25,7 +25,8 @@ struct ImageWrap
     VkImage          image{};
     VkDeviceMemory   memory{};
     VkImageView      imageView{};
-    VkSampler        sampler{};
+    VkSampler        sampler{};  // Shared:  see VkApp::acquireSampler
+    VkExtent2D       extent{};
     
     ImageWrap() : image(VK_NULL_HANDLE),  memory(VK_NULL_HANDLE),
                   imageView(VK_NULL_HANDLE), sampler(VK_NULL_HANDLE)
@@ -36,7 +37,7 @@ struct ImageWrap
         vkDestroyImage(device, image, nullptr);
         vkFreeMemory(device, memory, nullptr);
         vkDestroyImageView(device, imageView, nullptr);
-        vkDestroySampler(device, sampler, nullptr);
+        // Not the sampler, which VkApp::releaseSampler releases
     }
     
     VkDescriptorImageInfo Descriptor(VkImageLayout layout=VK_IMAGE_LAYOUT_GENERAL) const 
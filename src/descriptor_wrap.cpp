@@ -2,7 +2,8 @@
 #include "descriptor_wrap.h"
 #include <assert.h>
 
-void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt)
+void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt,
+                                 bool bindless)
 {
     uint maxSets = 1;  // 1 is good enough for us.  In general, may want more;
     bindingTable = _bt;
@@ -14,6 +15,19 @@ void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptor
     createInfo.flags = 0;
     createInfo.pNext = nullptr;
 
+    // Bindless: sparsely filled arrays, written while in use, the last
+    // of which is allocated at its full descriptorCount.
+    std::vector<VkDescriptorBindingFlags> bindingFlags(bindingTable.size(),
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT);
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO};
+    if (bindless) {
+        bindingFlags.back() |= VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+        flagsInfo.bindingCount  = uint32_t(bindingFlags.size());
+        flagsInfo.pBindingFlags = bindingFlags.data();
+        createInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        createInfo.pNext = &flagsInfo; }
+
     VkDescriptorSetLayout descriptorSetLayout;
     vkCreateDescriptorSetLayout(device, &createInfo, nullptr, &descSetLayout);
 
@@ -40,7 +54,7 @@ void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptor
     descrPoolInfo.maxSets                    = maxSets;
     descrPoolInfo.poolSizeCount              = poolSizes.size();
     descrPoolInfo.pPoolSizes                 = poolSizes.data();
-    descrPoolInfo.flags                      = 0;
+    descrPoolInfo.flags = bindless ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT : 0;
 
     vkCreateDescriptorPool(device, &descrPoolInfo, nullptr, &descPool);
 
@@ -50,6 +64,14 @@ void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptor
     allocInfo.descriptorSetCount          = 1;
     allocInfo.pSetLayouts                 = &descSetLayout;
 
+    uint32_t variableCount = bindingTable.back().descriptorCount;
+    VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO};
+    countInfo.descriptorSetCount = 1;
+    countInfo.pDescriptorCounts  = &variableCount;
+    if (bindless)
+        allocInfo.pNext = &countInfo;
+
     // Warning: The next line creates a single descriptor set from the
     // above pool since that's all our program needs.  This is too
     // restrictive in general, but fine for this program.
@@ -58,6 +80,8 @@ void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptor
 
 void DescriptorWrap::destroy(VkDevice device)
 {
+    if (updateTemplate != VK_NULL_HANDLE)
+        vkDestroyDescriptorUpdateTemplate(device, updateTemplate, nullptr);
     vkDestroyDescriptorSetLayout(device, descSetLayout, nullptr);
     vkDestroyDescriptorPool(device, descPool, nullptr);
 }
@@ -154,3 +178,137 @@ void DescriptorWrap::write(VkDevice& device, uint index, const VkAccelerationStr
     
     vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr);
 }
+
+void DescriptorWrap::write(VkDevice& device, uint index, uint element, const VkBuffer& buffer)
+{
+    VkDescriptorBufferInfo desBuf{buffer, 0, VK_WHOLE_SIZE};
+    VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    writeSet.dstSet          = descSet;
+    writeSet.dstBinding      = index;
+    writeSet.dstArrayElement = element;
+    writeSet.descriptorCount = 1;
+    writeSet.descriptorType  = bindingTable[index].descriptorType;
+    writeSet.pBufferInfo = &desBuf;
+
+    assert(bindingTable[index].binding == index);
+    assert(element < bindingTable[index].descriptorCount);
+
+    assert(writeSet.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER ||
+           writeSet.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    
+    vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr);
+}
+
+void DescriptorWrap::write(VkDevice& device, uint index, uint element, const VkDescriptorImageInfo& imageDesc)
+{
+    VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    writeSet.dstSet          = descSet;
+    writeSet.dstBinding      = index;
+    writeSet.dstArrayElement = element;
+    writeSet.descriptorCount = 1;
+    writeSet.descriptorType  = bindingTable[index].descriptorType;
+    writeSet.pImageInfo      = &imageDesc;
+
+    assert(bindingTable[index].binding == index);
+    assert(element < bindingTable[index].descriptorCount);
+
+    assert(writeSet.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+           writeSet.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+           writeSet.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    
+    vkUpdateDescriptorSets(device, 1, &writeSet, 0, nullptr);
+}
+
+void DescriptorWrap::createTemplate(VkDevice device, uint index, const std::vector<uint>& elements)
+{
+    templateElements = elements;
+    const VkDescriptorSetLayoutBinding& binding = bindingTable[index];
+    assert(binding.binding == index);
+    std::vector<VkDescriptorUpdateTemplateEntry> entries;
+    for (size_t i = 0; i < elements.size(); i++) {
+        assert(elements[i] < binding.descriptorCount);
+        VkDescriptorUpdateTemplateEntry entry{};
+        entry.dstBinding      = binding.binding;
+        entry.dstArrayElement = elements[i];
+        entry.descriptorCount = 1;
+        entry.descriptorType  = binding.descriptorType;
+        entry.offset          = i * sizeof(DescriptorData);
+        entry.stride          = sizeof(DescriptorData);
+        entries.push_back(entry); }
+
+    VkDescriptorUpdateTemplateCreateInfo createInfo{
+        VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO};
+    createInfo.descriptorUpdateEntryCount = uint32_t(entries.size());
+    createInfo.pDescriptorUpdateEntries   = entries.data();
+    createInfo.templateType               = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+    createInfo.descriptorSetLayout        = descSetLayout;
+    vkCreateDescriptorUpdateTemplate(device, &createInfo, nullptr, &updateTemplate);
+}
+
+void DescriptorWrap::writeTemplate(VkDevice device, const std::vector<DescriptorData>& data)
+{
+    assert(updateTemplate != VK_NULL_HANDLE && data.size() == templateElements.size());
+    vkUpdateDescriptorSetWithTemplate(device, descSet, updateTemplate, data.data());
+}
+
+VkWriteDescriptorSet& DescriptorBatch::add(DescriptorWrap& desc, uint index, uint count, uint element)
+{
+    assert(desc.bindingTable[index].binding == index);
+    assert(element + count <= desc.bindingTable[index].descriptorCount);
+    VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    writeSet.dstSet          = desc.descSet;
+    writeSet.dstBinding      = index;
+    writeSet.dstArrayElement = element;
+    writeSet.descriptorCount = count;
+    writeSet.descriptorType  = desc.bindingTable[index].descriptorType;
+    writes.push_back(writeSet);
+    return writes.back();
+}
+
+void DescriptorBatch::write(DescriptorWrap& desc, uint index, const VkBuffer& buffer)
+{
+    bufferInfos.push_back(VkDescriptorBufferInfo{buffer, 0, VK_WHOLE_SIZE});
+    add(desc, index, 1).pBufferInfo = &bufferInfos.back();
+}
+
+void DescriptorBatch::write(DescriptorWrap& desc, uint index, const VkDescriptorImageInfo& imageDesc)
+{
+    imageInfos.push_back({imageDesc});
+    add(desc, index, 1).pImageInfo = imageInfos.back().data();
+}
+
+void DescriptorBatch::write(DescriptorWrap& desc, uint index, uint element, const VkDescriptorImageInfo& imageDesc)
+{
+    imageInfos.push_back({imageDesc});
+    add(desc, index, 1, element).pImageInfo = imageInfos.back().data();
+}
+
+void DescriptorBatch::write(DescriptorWrap& desc, uint index, const std::vector<ImageWrap>& textures)
+{
+    imageInfos.emplace_back();
+    for (auto& texture : textures)
+        imageInfos.back().emplace_back(texture.Descriptor(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+    add(desc, index, uint(textures.size())).pImageInfo = imageInfos.back().data();
+}
+
+void DescriptorBatch::write(DescriptorWrap& desc, uint index, const VkAccelerationStructureKHR& tlas)
+{
+    tlases.push_back(tlas);
+    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
+    descASInfo.accelerationStructureCount = 1;
+    descASInfo.pAccelerationStructures    = &tlases.back();
+    tlasInfos.push_back(descASInfo);
+    add(desc, index, 1).pNext = &tlasInfos.back();
+}
+
+void DescriptorBatch::flush(VkDevice device)
+{
+    if (!writes.empty())
+        vkUpdateDescriptorSets(device, uint32_t(writes.size()), writes.data(), 0, nullptr);
+    writes.clear();
+    bufferInfos.clear();
+    imageInfos.clear();
+    tlases.clear();
+    tlasInfos.clear();
+}
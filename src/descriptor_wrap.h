@@ -2,10 +2,19 @@
 #pragma once
 
 #include <stdio.h>
+#include <deque>
 #include <string>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
+// One descriptor's data, as an update template reads it
+union DescriptorData
+{
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
+    VkAccelerationStructureKHR tlas;
+};
+
 class DescriptorWrap
 {
 public:
@@ -15,7 +24,11 @@ public:
     VkDescriptorPool descPool;
     VkDescriptorSet descSet;    // Could be  vector<VkDescriptorSet> for multiple sets;
     
-    void setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt);
+    // With bindless, every binding is partially bound and updatable
+    // after binding, and the last one's descriptorCount is its
+    // variable count's upper bound (see vkapp_bindless.cpp).
+    void setBindings(const VkDevice device, std::vector<VkDescriptorSetLayoutBinding> _bt,
+                     bool bindless = false);
     void destroy(VkDevice device);
 
     // Any data can be written into a descriptor set.  Apparently I need only these few types:
@@ -23,4 +36,41 @@ public:
     void write(VkDevice& device, uint index, const VkDescriptorImageInfo& textureDesc);
     void write(VkDevice& device, uint index, const std::vector<ImageWrap>& textures);
     void write(VkDevice& device, uint index, const VkAccelerationStructureKHR& tlas);
+
+    // Single elements of an array binding, as the bindless table's handles are
+    void write(VkDevice& device, uint index, uint element, const VkBuffer& buffer);
+    void write(VkDevice& device, uint index, uint element, const VkDescriptorImageInfo& imageDesc);
+
+    // An update template over some elements of one array binding:
+    // writeTemplate rewrites all of them in one call, from one
+    // DescriptorData per element, in createTemplate's order.
+    VkDescriptorUpdateTemplate updateTemplate = VK_NULL_HANDLE;
+    std::vector<uint> templateElements;
+    void createTemplate(VkDevice device, uint index, const std::vector<uint>& elements);
+    void writeTemplate(VkDevice device, const std::vector<DescriptorData>& data);
+};
+
+// Writes to any number of sets, collected and then made in a single
+// vkUpdateDescriptorSets by flush.  The descriptor data is copied, so
+// the arguments need not outlive the calls.
+class DescriptorBatch
+{
+public:
+    void write(DescriptorWrap& desc, uint index, const VkBuffer& buffer);
+    void write(DescriptorWrap& desc, uint index, const VkDescriptorImageInfo& imageDesc);
+    void write(DescriptorWrap& desc, uint index, uint element, const VkDescriptorImageInfo& imageDesc);
+    void write(DescriptorWrap& desc, uint index, const std::vector<ImageWrap>& textures);
+    void write(DescriptorWrap& desc, uint index, const VkAccelerationStructureKHR& tlas);
+    void flush(VkDevice device);
+    size_t size() const { return writes.size(); }
+
+private:
+    // Deques, as growing them leaves the earlier elements, which the
+    // writes point to, in place.
+    std::vector<VkWriteDescriptorSet> writes;
+    std::deque<VkDescriptorBufferInfo> bufferInfos;
+    std::deque<std::vector<VkDescriptorImageInfo>> imageInfos;
+    std::deque<VkAccelerationStructureKHR> tlases;
+    std::deque<VkWriteDescriptorSetAccelerationStructureKHR> tlasInfos;
+    VkWriteDescriptorSet& add(DescriptorWrap& desc, uint index, uint count, uint element = 0);
 };
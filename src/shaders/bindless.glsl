@@ -0,0 +1,16 @@
+// The bindless table (see vkapp_bindless.cpp):  storage buffers,
+// storage images and textures, indexed by the handles VkApp's
+// bindless* functions return.  The including shader defines
+// BINDLESS_SET, the table's set in its pipeline layout, and includes
+// shared_structs.h first, with GL_EXT_nonuniform_qualifier enabled.
+// Index with nonuniformEXT wherever a handle may differ across a
+// subgroup.
+
+layout(set=BINDLESS_SET, binding=BINDLESS_BUFFERS) buffer _BindlessBuffers { uint u[]; } bindlessBuffers[];
+// The storage images, declared once per format in use:  a handle must
+// be read through the declaration of its image's format.
+layout(set=BINDLESS_SET, binding=BINDLESS_IMAGES, rgba16f) uniform image2D bindlessImages[];
+layout(set=BINDLESS_SET, binding=BINDLESS_IMAGES, rg32ui) uniform uimage2D bindlessImagesRg32ui[];
+layout(set=BINDLESS_SET, binding=BINDLESS_IMAGES, rg32f) uniform image2D bindlessImagesRg32f[];
+layout(set=BINDLESS_SET, binding=BINDLESS_IMAGES, r32f) uniform image2D bindlessImagesR32f[];
+layout(set=BINDLESS_SET, binding=BINDLESS_TEXTURES) uniform sampler2D bindlessTextures[];
@@ -0,0 +1,8 @@
+// Color helpers shared by the path tracer (pathtrace.glsl) and the
+// passes over its output.
+
+// Relative luminance of a linear Rec. 709 color
+float Luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
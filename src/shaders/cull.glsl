@@ -0,0 +1,116 @@
+// The GPU-driven raster's culling tests, shared by cull.comp and
+// meshlet.task, on the bindings of VkApp's CullList descriptor sets.
+// The includer defines CULL_SET, their set number.
+
+layout(set = CULL_SET, binding = 0, scalar) buffer readonly _CullInstances { CullInstance instances[]; };
+layout(set = CULL_SET, binding = 3, scalar) buffer _CullStats { CullStats stats; };
+layout(set = CULL_SET, binding = 4, scalar) buffer _Visibility { uint visible[]; };  // Per instance, as of the late pass
+layout(set = CULL_SET, binding = 5) uniform _CullMatrixUniforms { MatrixUniforms mats; };
+layout(set = CULL_SET, binding = 6) uniform sampler2D hiz;  // Depth pyramid:  farthest depth of each texel's pixels
+
+// Whether the world space sphere is wholly outside the view frustum.
+// The planes are the rows of the view-projection combined:  a point
+// is inside where -w <= x,y <= w and 0 <= z <= w.  Each is normalized
+// so its distances compare with the radius.
+bool FrustumCulled(vec3 center, float radius)
+{
+    mat4 m = transpose(mats.viewProj);  // Its rows
+    vec4 planes[6] = vec4[6](m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[2], m[3] - m[2]);
+    for (int i = 0; i < 6; i++)
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz))
+            return true;
+    return false;
+}
+
+// Whether every triangle within the sphere, with normals in the cone,
+// faces away from the eye.  (See Meshlet in vkapp.h.)
+bool ConeCulled(vec3 center, float radius, vec3 axis, float cutoff, vec3 eye)
+{
+    vec3 d = center - eye;
+    return cutoff < 1.0 && dot(d, axis) >= cutoff * length(d) + radius;
+}
+
+// Whether the world space sphere is wholly behind the depth pyramid.
+// Its screen rectangle, in pixels, is that of its bounding box's
+// corners;  the pyramid level at which the rectangle spans at most
+// 2x2 texels gives the farthest depth over it, in four fetches.
+bool Occluded(PushConstantCull pc, vec3 center, float radius)
+{
+    vec2 lo = vec2(1e30), hi = vec2(-1e30);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1 : -1,
+                                             (i & 2) != 0 ? 1 : -1,
+                                             (i & 4) != 0 ? 1 : -1);
+        vec4 clip = mats.viewProj * vec4(corner, 1.0);
+        if (clip.w <= 1e-5)
+            return false;  // Crosses the camera plane
+        vec3 ndc = clip.xyz / clip.w;
+        lo = min(lo, ndc.xy);
+        hi = max(hi, ndc.xy);
+        nearest = min(nearest, ndc.z); }
+
+    vec2 size = vec2(pc.width, pc.height);
+    ivec2 p0 = clamp(ivec2((lo * 0.5 + 0.5) * size), ivec2(0), ivec2(size) - 1);
+    ivec2 p1 = clamp(ivec2((hi * 0.5 + 0.5) * size), ivec2(0), ivec2(size) - 1);
+
+    // Each texel of level L covers 2^L x 2^L pixels, but for the last
+    // of an odd edge, which also covers those beyond (see hiz.comp).
+    int level = 0;
+    while (level < pc.hizLevels - 1
+           && ((p1.x >> level) - (p0.x >> level) > 1 || (p1.y >> level) - (p0.y >> level) > 1))
+        level++;
+    ivec2 last = textureSize(hiz, level) - 1;
+    ivec2 t0 = min(p0 >> level, last);
+    ivec2 t1 = min(p1 >> level, last);
+    float farthest = max(max(texelFetch(hiz, t0, level).r, texelFetch(hiz, ivec2(t1.x, t0.y), level).r),
+                         max(texelFetch(hiz, ivec2(t0.x, t1.y), level).r, texelFetch(hiz, t1, level).r));
+    return nearest > farthest;
+}
+
+// Whether pc's pass draws instance index, keeping its visibility and
+// the stats.  The early pass tests only those visible last frame;  the
+// late pass tests every instance, and draws only those newly visible.
+bool CullTest(PushConstantCull pc, uint index)
+{
+    if (pc.phase == CULL_EARLY && visible[index] == 0)
+        return false;
+    CullInstance inst = instances[index];
+    bool counted = pc.phase != CULL_EARLY;  // The last pass counts them all
+
+    // The sphere and cone in world space, the radius scaled by the
+    // transform's largest axis scale.  (The cone's axis is exact for
+    // rigid and uniformly scaled transforms.)
+    vec3 center = vec3(inst.transform * vec4(inst.sphere.xyz, 1.0));
+    float scale = max(length(inst.transform[0].xyz),
+                      max(length(inst.transform[1].xyz), length(inst.transform[2].xyz)));
+    float radius = inst.sphere.w * scale;
+    vec3 axis = normalize(mat3(inst.transform) * inst.cone.xyz);
+    vec3 eye = vec3(mats.viewInverse * vec4(0, 0, 0, 1));
+
+    if (FrustumCulled(center, radius)) {
+        if (counted) {
+            atomicAdd(stats.frustumCulled, 1);
+            visible[index] = 0; }
+        return false; }
+
+    if (ConeCulled(center, radius, axis, inst.cone.w, eye)) {
+        if (counted) {
+            atomicAdd(stats.coneCulled, 1);
+            visible[index] = 0; }
+        return false; }
+
+    if (pc.phase == CULL_LATE) {
+        if (Occluded(pc, center, radius)) {
+            atomicAdd(stats.occlusionCulled, 1);
+            visible[index] = 0;
+            return false; }
+        bool drawnEarly = visible[index] != 0;
+        visible[index] = 1;
+        if (drawnEarly)
+            return false;
+        atomicAdd(stats.drawnLate, 1); }
+
+    atomicAdd(stats.drawn, 1);
+    return true;
+}
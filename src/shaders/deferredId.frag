@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : enable
+
+// The deferred raster's ID pass (see vkapp_deferred.cpp):  each pixel
+// keeps only which triangle it sees, as the ray tracer's RayPayload
+// does:  the object (x) and triangle (y) indices.  deferred.comp
+// shades it afterwards.
+
+layout(location=5) flat in uint objIndex;    // See scanline.vert
+layout(location=6) flat in uint primOffset;
+
+layout(location = 0) out uvec2 id;
+
+void main()
+{
+  id = uvec2(objIndex, primOffset + gl_PrimitiveID);
+}
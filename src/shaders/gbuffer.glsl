@@ -0,0 +1,33 @@
+// Packed G-buffer texels of the ray tracer's first hits, shared by
+// pathtrace.glsl and denoise.comp.  The normal:depth images
+// (m_rtNd*Buffer) are rg32ui: an octahedral-encoded normal in two
+// 16-bit snorms, then the depth as a 32-bit float.
+
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e;
+}
+
+vec3 OctDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+uvec4 PackNormalDepth(vec3 nrm, float depth)
+{
+    return uvec4(packSnorm2x16(OctEncode(nrm)), floatBitsToUint(depth), 0, 0);
+}
+
+// Returns the unit normal in xyz and the depth in w.
+vec4 UnpackNormalDepth(uvec4 nd)
+{
+    return vec4(OctDecode(unpackSnorm2x16(nd.x)), uintBitsToFloat(nd.y));
+}
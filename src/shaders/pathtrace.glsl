@@ -0,0 +1,530 @@
+// The path tracer shared by the ray tracing pipeline (raytrace.rgen),
+// the ray query compute backend (raytrace.comp), and (in pieces) the
+// wavefront tracer (wavefront.comp).  The including
+// shader declares the RayPayload payload global, and defines TraceRay,
+// TraceShadowRay and a main that calls PathTrace.
+
+#include "rng.glsl"
+#include "gbuffer.glsl"
+#include "color.glsl"
+
+#define pi (3.141592)
+#define pi2 (2.0*pi)
+
+// Ray casts, defined by the including backend.  TraceRay leaves its
+// results in the global RayPayload payload;  TraceShadowRay returns
+// true if anything lies between origin and origin+tMax*direction.
+void TraceRay(vec3 origin, vec3 direction);
+bool TraceShadowRay(vec3 origin, vec3 direction, float tMax);
+
+// Push constant for ray tracing; structure is defined in shared_structs.h;
+// Filled in by application, and pushed to shaders as part of the pipeline invocation
+layout(push_constant) uniform _PushConstantRay { PushConstantRay pcRay; };
+
+// Ray tracing descriptor set: 0:acceleration structure, 1: emitters.
+// The color, normal:depth and moment histories are in the bindless
+// table, by pcRay's handles.
+layout(set=0, binding=0) uniform accelerationStructureEXT topLevelAS;
+layout(set = 0, binding = 1, scalar) buffer _emitter { Emitter list[]; } emitter;
+// First hit's albedo
+layout(set = 0, binding = 2, rgba8) uniform image2D kdCurr;
+// Adaptive sampling: the per-pixel sample multiplier built by variance.comp
+layout(set = 0, binding = 3, r16f) uniform image2D sampleMask;
+// Counters for the backends' rays/s and lane utilization reports
+layout(set = 0, binding = 4) buffer _RayStats { RayStats rayStats; };
+// First hit's screen-space motion, in pixels, to its previous position
+layout(set = 0, binding = 5, rg16f) uniform image2D motion;
+// Hybrid rendering: each pixel's rasterized first hit (see visibility.frag)
+layout(set = 0, binding = 6, rgba32ui) uniform readonly uimage2D visibility;
+
+// Object model descriptor set: 0: matrices, 1:object buffer addresses,
+// 2: per instance motion (last frame's transform times this frame's inverse),
+// 3: per instance transform
+layout(set=1, binding=0) uniform _MatrixUniforms { MatrixUniforms mats; };
+layout(set=1, binding=1, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
+layout(set=1, binding=2, scalar) buffer _InstanceMotion { mat4 m[]; } instanceMotion;
+layout(set=1, binding=3, scalar) buffer _InstanceTransforms { mat4 m[]; } instanceTransforms;
+
+// The textures and the histories, by handle, from the bindless table:
+// set 2, after the two above, unless the including shader has more
+// sets of its own.
+#ifndef BINDLESS_SET
+#define BINDLESS_SET 2
+#endif
+#include "bindless.glsl"
+
+// Object buffered data; dereferenced from ObjDesc addresses;  Must be global
+layout(buffer_reference, scalar) buffer Vertices {Vertex v[]; }; // Position, normals, ..
+layout(buffer_reference, scalar) buffer Indices {ivec3 i[]; }; // Triangle indices
+layout(buffer_reference, scalar) buffer Materials {Material m[]; }; // Array of all materials
+layout(buffer_reference, scalar) buffer MatIndices {int i[]; }; // Material ID for each triangle
+layout(buffer_reference, scalar) buffer LodBiases {float l[]; }; // Texture LOD bias for each triangle
+
+// Raycasting: Write EvalBrdf -- The BRDF lighting calculation
+/* Project3
+vec3 EvalBrdf(vec3 N, vec3 L, vec3 V, Material mat) 
+{
+    float alpha = mat.shininess;
+    vec3 H = (L + V) / length(L + V);
+    float tan_v = sqrt(1.0f - pow(dot(V, N), 2)) / dot(V, N);
+    float a = sqrt(alpha / 2.0f + 1.0f) / tan_v;
+
+    float D = ((alpha + 1.0f) / pi2) * pow(dot(N, H), alpha);
+    vec3 F = mat.specular + (vec3(1.0f) - mat.specular) * pow(1.0f - dot(L, H), 5.0f);
+    
+    //float G = 1.0f / pow(dot(L, H), 2.0f);
+    //Beckman uses this very accurate rational approximation
+    float G = (a < 1.6f ? (3.535 * a + 2.181 * a * a) / (1.0 + 2.276 * a + 2.577 * a * a) : 1.0f);
+
+    return (mat.diffuse / pi) + (D * F * G) / (4.0f * dot(L, N) * dot(V, N));
+}
+*/
+vec3 EvalBrdf(vec3 N, vec3 L, vec3 V, Material mat)
+{
+    vec3 Kd = mat.diffuse;
+    vec3 Ks = mat.specular;
+    const float alpha = mat.shininess;
+
+    vec3 H = normalize(L + V);
+    float LH = dot(L, H);
+
+    vec3 F = Ks + (vec3(1.0) - Ks) * pow((1 - LH), 5);
+
+    float mN = dot(H, N);
+    float tan_square_theta_m = (1.0 - mN * mN) / mN * mN;
+    float alpha_square = alpha * alpha;
+    float D = clamp(mN, 0.0, 1.0) * alpha_square
+            / (pi * pow(mN, 4) * pow(alpha_square + tan_square_theta_m, 2));
+
+    float mV = dot(H, V);
+    float NV = dot(N, V);
+    float tan_square_theta_v = (1.0 -  NV * NV) /  NV * NV;
+    float GV;
+    if(NV > 1.0 || sqrt(tan_square_theta_v) == 0)
+    {
+        GV = 1.0;
+    }
+    else
+    {
+        int x;
+        if (mV / NV > 0) x = 1;
+        else x = 0;
+        GV = x * 2 / (1.0 + sqrt(1 + alpha_square * tan_square_theta_v));
+    }
+
+    float mL = LH; // dot(L, H);
+    float NL = dot(N, L);
+    float tan_square_theta_l = (1.0 -  NL * NL) /  NL * NL;
+    float GL;
+    if(NL > 1.0 || sqrt(tan_square_theta_l) == 0)
+    {
+        GL = 1.0;
+    }
+    else
+    {
+        int x;
+        if (mL / NL > 0) x = 1;
+        else x = 0;
+        GL = x * 2 / (1.0 + sqrt(1 + alpha_square * tan_square_theta_l));
+    }
+    float G = GV * GL;
+
+    return max(NL, 0.0) * ((Kd / pi) + ( (D * G * F) / (4 * abs(NL) * abs(NV)) ) );
+} 
+
+vec3 SampleLobe(vec3 A, float c, float phi) {
+    float s = sqrt(1.0 - c * c);
+    vec3 K = vec3(s * cos(phi), s * sin(phi), c);
+
+    if (abs(A.z - 1.0) < 1e-3) return K;            
+    if (abs(A.z + 1.0) < 1e-3) return vec3(K.x, -K.y, -K.z); 
+
+    A = normalize(A);  
+    vec3 B = normalize(vec3(-A.y, A.x, 0.0)); 
+    vec3 C = cross(A, B);  
+    
+    return K.x * B + K.y * C + K.z * A;
+}
+
+vec3 SampleBrdf(inout uint seed, in vec3 N) 
+{ 
+    float r1 = sqrt(rnd(seed));
+    float r2 = 2.0 * 3.14159 * rnd(seed);
+    return SampleLobe(N, r1, r2);
+}
+
+float PdfBrdf(vec3 N, vec3 Wi) 
+{
+    return max(dot(N, Wi), 0.0) / 3.14159;
+}
+// and more
+vec3 SampleTriangle(inout uint seed, vec3 A, vec3 B, vec3 C)
+{
+    float b2 = rnd(seed);
+    float b1 = rnd(seed);
+    float b0 = 1.0 - b1 - b2;
+    
+    if(b0 < 0.0)    // Test for outer triangle; If so invert into inner triangle
+    {
+        b1 = 1.0 - b1;
+        b2 = 1.0 - b2;
+        b0 = 1.0 - b1 - b2;
+    }
+
+    return b0*A + b1*B + b2*C;
+}
+Emitter SampleLight(inout uint seed)
+{
+    Emitter randLight = emitter.list[uint(rnd(seed) * emitter.list.length())];
+    randLight.point = SampleTriangle(seed, randLight.v0, randLight.v1, randLight.v2);
+
+    return randLight;
+}
+float PdfLight(Emitter L)
+{
+    return 1.0 / (L.area * emitter.list.length());
+}
+vec3 EvalLight(Emitter L)
+{
+    return L.emission;
+}
+float GeometryFactor(vec3 Pa, vec3 Na, vec3 Pb, vec3 Nb)
+{
+    vec3 D = Pa - Pb;
+    return abs((dot(D, Na) * dot(D, Nb)) / pow(dot(D, D), 2.0));
+}
+
+// Given a ray's payload indicating a triangle has been hit
+// (payload.instanceIndex and payload.primIndex say which triangle),
+// lookup/calculate the material, texture and normal at the hit point
+// from the three vertices of the hit triangle.  The vertices are in
+// object space;  the instance's transform takes the normal, and the
+// triangle's texel density, to world space, where the ray is.  The
+// ray's cone width at the hit point selects the texture's mip level.
+void GetHitObjectData(out Material mat, out vec3 nrm, float coneWidth, vec3 rayDir)
+{
+    int instanceIndex  = int(payload.instanceIndex);
+    int primitiveIndex = int(payload.primIndex);
+
+    // Object data (containing 5 device addresses)
+    ObjDesc    objResources = objDesc.i[instanceIndex];
+    
+    // Dereference the object's 5 device addresses
+    Vertices   vertices    = Vertices(objResources.vertexAddress);
+    Indices    indices     = Indices(objResources.indexAddress);
+    Materials  materials   = Materials(objResources.materialAddress);
+    MatIndices matIndices  = MatIndices(objResources.materialIndexAddress);
+    LodBiases  lodBiases   = LodBiases(objResources.lodBiasAddress);
+  
+    // Use gl_PrimitiveID to access the triangle's vertices and material
+    ivec3 ind    = indices.i[primitiveIndex]; // The triangle hit
+    int matIdx   = matIndices.i[primitiveIndex]; // The triangles material index
+    mat = materials.m[matIdx]; // The triangles material
+
+    // Vertex of the triangle (Vertex has pos, nrm, tex)
+    Vertex v0 = vertices.v[ind.x];
+    Vertex v1 = vertices.v[ind.y];
+    Vertex v2 = vertices.v[ind.z];
+
+    // Normals transform by the inverse transpose of the instance's
+    // transform (its cofactor matrix, up to the determinant's scale).
+    mat3 toWorld  = mat3(instanceTransforms.m[instanceIndex]);
+    mat3 nrmWorld = transpose(inverse(toWorld));
+
+    // Compute normal at hit position using the provided barycentric coordinates.
+    const vec3 bc = vec3(1.0 - payload.bc.x - payload.bc.y, payload.bc); // The barycentric coordinates of the hit point
+    nrm  = nrmWorld * (bc.x*v0.nrm + bc.y*v1.nrm + bc.z*v2.nrm); // Normal = combo of three vertex normals
+
+    // If the material has a texture, read texture and use as the
+    // point's diffuse color.
+    if (mat.textureId >= 0) {
+        vec2 uv =  bc.x*v0.texCoord + bc.y*v1.texCoord + bc.z*v2.texCoord;
+        uint txtId = objResources.txtOffset + mat.textureId; // tex coord from three vertices
+
+        // Ray cone LOD: the triangle's texel-to-world area ratio
+        // (precomputed per triangle in object space, less the texture
+        // size, then scaled by the instance's stretching of the
+        // triangle's area), plus the cone's footprint on the triangle.
+        // A transform M scales the area of a triangle with unit normal
+        // n by |det M| * |M^-T n|.
+        vec3 gnrm = normalize(cross(v1.pos - v0.pos, v2.pos - v0.pos));
+        vec3 gnrmWorld = nrmWorld * gnrm;
+        float areaScale = max(abs(determinant(toWorld)) * length(gnrmWorld), 1e-12);
+        float cosTheta = max(abs(dot(normalize(gnrmWorld), rayDir)), 1e-3);
+        ivec2 txtSize = textureSize(bindlessTextures[nonuniformEXT(txtId)], 0);
+        float lod = lodBiases.l[primitiveIndex] - 0.5*log2(areaScale)
+            + 0.5*log2(float(txtSize.x*txtSize.y))
+            + log2(max(coneWidth, 1e-6) / cosTheta);
+        mat.diffuse = textureLod(bindlessTextures[nonuniformEXT(txtId)], uv, lod).xyz; }
+}
+
+// Hybrid rendering:  fill the payload with the pixel's first hit, as
+// rasterized into the visibility buffer, in place of tracing its eye
+// ray.  The seed is left alone.
+void PrimaryVisibility(ivec2 pixel)
+{
+    uvec4 v = imageLoad(visibility, pixel);
+    float dist = uintBitsToFloat(v.z);
+    payload.hitDist = dist > 0.0 ? dist : -1.0;
+    payload.instanceIndex = v.x;
+    payload.primIndex = v.y;
+    payload.bc = unpackUnorm2x16(v.w);
+}
+
+// Calculate a pixel's center (in NDC) and convert it to a ray in
+// world coordinates.
+void EyeRay(ivec2 pixel, ivec2 size, out vec3 eyeW, out vec3 eyeDirection)
+{
+    const vec2 pixelCenter = vec2(pixel) + vec2(0.5);
+    vec2 pixelNDC = pixelCenter/vec2(size)*2.0 - 1.0;
+ 
+    eyeW    = (mats.viewInverse * vec4(0, 0, 0, 1)).xyz;
+    vec4 pixelH = mats.viewInverse * mats.projInverse * vec4(pixelNDC.x, pixelNDC.y, 1, 1);
+    vec3 pixelW = pixelH.xyz/pixelH.w;
+    eyeDirection = normalize(pixelW - eyeW);
+}
+
+// Screen-space motion of the pixel's first hit, in pixels, from its
+// position in the previous frame to this one's pixel center.  A hit
+// point is carried back by its instance's motion;  a miss is taken
+// as a point at infinity, which moves only with the camera.  The eye
+// ray went through the pixel center plus the camera's jitter, while
+// the prior frame's matrix is unjittered, so the jitter is taken out.
+vec2 MotionVector(ivec2 pixel, ivec2 size, bool firstHit, vec3 firstPos, uint firstInstance)
+{
+    vec4 prevH;
+    if (firstHit) {
+        vec4 prevPos = instanceMotion.m[firstInstance] * vec4(firstPos, 1.0);
+        prevH = mats.priorViewProj * prevPos; }
+    else {
+        vec3 eyeW, eyeDirection;
+        EyeRay(pixel, size, eyeW, eyeDirection);
+        prevH = mats.priorViewProj * vec4(eyeDirection, 0.0); }
+
+    vec2 prevScreen = ((prevH.xy / prevH.w) + vec2(1.0)) / 2.0 * vec2(size);
+    return prevScreen - (vec2(pixel) + vec2(0.5) + mats.jitter.xy);
+}
+
+// Write the average C of spp new samples (and the average of their
+// squared luminances), and the first hit's G-buffer texels and motion
+// vector.  reproject.comp then folds the new samples into the history.
+void WriteSamples(ivec2 pixel, ivec2 size, vec3 C, float L2sum, int spp,
+                  bool firstHit, float firstDepth, vec3 firstNrm, vec3 firstKd,
+                  vec3 firstPos, uint firstInstance)
+{
+    // The stored normal is a unit vector, so compare with one.
+    firstNrm = firstHit ? normalize(firstNrm) : vec3(0, 0, 1);
+
+    imageStore(bindlessImages[pcRay.colCurr], pixel, vec4(C, float(spp)));
+    imageStore(bindlessImagesRg32f[pcRay.momCurr], pixel,
+               vec4(L2sum / float(spp), firstHit ? 1.0 : 0.0, 0.0, 0.0));
+    imageStore(kdCurr, pixel, vec4(firstKd, 0.0));
+    imageStore(bindlessImagesRg32ui[pcRay.ndCurr], pixel, PackNormalDepth(firstNrm, firstDepth));
+    imageStore(motion, pixel, vec4(MotionVector(pixel, size, firstHit, firstPos, firstInstance), 0.0, 0.0));
+}
+
+// Trace this launch's paths for one pixel, and write them for
+// reproject.comp.  launchID is the invocation's position within the
+// launch, which may cover only one tile of the screen; the tile's
+// origin offsets it to the pixel.
+void PathTrace(ivec2 launchID)
+{
+    const ivec2 pixel = launchID + ivec2(pcRay.tileX, pcRay.tileY);
+    const ivec2 size = ivec2(pcRay.width, pcRay.height);
+    if (pixel.x >= size.x || pixel.y >= size.y)
+        return;
+
+    // Raycasting: Since the alignment of pcRay is SO easy to get wrong, test it
+    // here and flag problems with a fully red screen.
+    if (pcRay.alignmentTest != 1234) {
+        imageStore(bindlessImages[pcRay.colCurr], pixel, vec4(1,0,0,0));
+        return; }
+    
+    // This pixel's ray:
+    vec3 eyeW, eyeDirection;
+    EyeRay(pixel, size, eyeW, eyeDirection);
+    vec3 rayOrigin;
+    vec3 rayDirection;
+
+    // The ray-casting / path-tracing block/loop will store each
+    // path's calculated color in C, and the sum over all of this
+    // launch's paths in Csum.
+    vec3 C;
+    vec3 Csum = vec3(0,0,0);
+    // The path tracing algorithm will accumulate a product of f/p weights in W.
+    vec3 W;
+    
+    payload.seed = tea(uint(pixel.y*size.x + pixel.x), pcRay.frameSeed);
+    bool firstHit = false;
+    float firstDepth;
+    vec3 firstNrm, firstKd, firstPos;
+    uint firstInstance;
+
+    // All paths of this launch start with the same primary ray, so
+    // it is traced once and its payload reused by the later samples.
+    RayPayload primary;
+    int spp = max(pcRay.samplesPerLaunch, 1);
+
+    // Adaptive sampling: While the camera is still, the mask (from
+    // the previous frame) skips converged pixels (0), and gives
+    // extra samples to noisy ones (>1).  Skipped pixels' histories
+    // are carried over by reproject.comp.
+    if (pcRay.adaptive && !pcRay.clear) {
+        float m = imageLoad(sampleMask, pixel).x;
+        if (m == 0.0)
+            return;
+        spp = max(int(round(m * float(spp))), 1); }
+
+    // Sum over this launch's samples of each path's squared luminance.
+    float L2sum = 0.0;
+    uint rays = 0;
+    uint iters = 0;  // Bounce iterations executed, for lane utilization
+
+    // Samples loop: trace spp paths for this pixel in one launch.
+    for (int s=0; s<spp;  s++)
+    {
+        // Russian roulette: each path continues past a bounce with
+        // probability pcRay.rr, up to pcRay.depth bounces.
+        int depth = 1;
+        while (depth < pcRay.depth && rnd(payload.seed) < pcRay.rr)
+            depth++;
+
+        C = vec3(0,0,0);
+        W = vec3(1,1,1);
+        rayOrigin    = eyeW;
+        rayDirection = eyeDirection;
+
+        // Ray cone: width grows by spread per unit distance; each
+        // bounce widens the spread by the material's lobe.
+        float coneWidth  = 0.0;
+        float coneSpread = pcRay.coneSpread;
+
+        // Monte-Carlo loop.
+        for (int i=0; i<depth;  i++)
+            {
+            iters++;
+            if (i == 0 && s > 0) {
+                // Reuse the primary hit, but keep this path's random state.
+                uint seed = payload.seed;
+                payload = primary;
+                payload.seed = seed; }
+            else if (i == 0 && pcRay.hybrid) {
+                // The raster found it;  no ray is cast.
+                PrimaryVisibility(pixel);
+                primary = payload; }
+            else {
+                // Fire the ray;  results come back in the payload
+                TraceRay(rayOrigin, rayDirection);
+                rays++;
+                if (i == 0)
+                    primary = payload; }
+
+            // If nothing was hit
+            if (payload.hitDist < 0.0) {
+                //C = vec3(0,0,0);
+                break;
+            }
+        
+            // If something was hit, find the object data.
+            vec3 hitPos = rayOrigin + payload.hitDist * rayDirection;
+            coneWidth += coneSpread * payload.hitDist;
+            Material mat;
+            vec3 nrm;
+            GetHitObjectData(mat, nrm, coneWidth, rayDirection);
+            mat.emission *= 2.0;
+
+            if(i == 0 && s == 0)
+            {
+                firstHit = true;
+                firstDepth = payload.hitDist;
+                firstPos = hitPos;
+                firstInstance = payload.instanceIndex;
+                firstKd = mat.diffuse;
+                firstNrm = nrm;
+            }
+            // Test if the hit point's material is a light 
+            if (dot(mat.emission,mat.emission) > 0.0) 
+            {
+                if(pcRay.explicitLight)
+                    C += 0.5 * mat.emission * W;
+                else
+                    C += mat.emission * W;
+                break; 
+            }
+
+            if(pcRay.explicitLight)
+            {
+                Emitter light = SampleLight(payload.seed);
+                vec3 Wi =  normalize(light.point - hitPos);
+                float dist = length(light.point - hitPos);
+                bool shadowed = TraceShadowRay(hitPos, Wi, dist - 0.001);
+                rays++;
+
+                if(!shadowed)
+                {
+                    vec3 N = normalize(nrm);
+                    vec3 Wo = -rayDirection;
+                    vec3 f = EvalBrdf(N, Wi, Wo, mat);
+                    float p = PdfLight(light) / GeometryFactor(hitPos, N, light.point, light.normal);
+                
+                    C += 0.5 * W * f/p * EvalLight(light);
+                }
+            }
+
+            //   C += LIGHT * (N dot Wi) * EvalBRDF(N, Wi, Wo, mat)
+            // Data for the calculation:
+            //   Normal N = normalize(nrm) 
+            //   Light input direction Wi = normalize(pcRay.scLightPos-hitPos)
+            //   Light output direction Wo = -rayDirection (Note the negation!)
+            //   Light value from pcRay.scLightInt
+            //   Material properties from mat possibly modified by a texture
+            // As a great debugging aid. try C += abs(nrm); 
+        
+            // vec3 Wi = normalize(pcRay.scLightPos - hitPos);
+            // vec3 Wo = -rayDirection;
+        
+            // C += pcRay.scLightInt * max(0.0, dot(N, Wi)) * EvalBrdf(N, Wi, Wo, mat);
+
+
+            //   Sample random direction Wi = ?
+            //   Calculate f = (N dot Wi) * EvalBRDF(N, L, V, mat)
+            //   Calculate p = ?
+            //   Accumulate f/p into W;  No C += here anymore.
+            //   Setup for next loop iteration.
+
+            vec3 P = hitPos;
+            vec3 N = normalize(nrm);
+            vec3 Wi = SampleBrdf(payload.seed, N);  
+            vec3 Wo = -rayDirection;
+            vec3 f = EvalBrdf(N, Wi, Wo, mat);  
+            float p = PdfBrdf(N, Wi) * pcRay.rr; 
+            if (p < 1e-6) break;
+            W *= f / p;
+
+            rayOrigin = hitPos;
+            rayDirection = Wi;
+            coneSpread += sqrt(2.0 / (mat.shininess + 2.0));  // Phong lobe width
+
+
+            } // End of Monte-Carlo block/loop
+
+        Csum += C;
+        L2sum += Luminance(C) * Luminance(C);
+    } // End of samples loop
+
+    // The average of this launch's spp samples.  reproject.comp
+    // folds it into the running averages with a weight of spp.
+    C = Csum / float(spp);
+    WriteSamples(pixel, size, C, L2sum, spp, firstHit, firstDepth, firstNrm, firstKd,
+                 firstPos, firstInstance);
+
+    // Lane utilization: this invocation's loop iterations against
+    // those of the longest path in its subgroup, which all lanes wait for.
+    atomicAdd(rayStats.rays, rays);
+    atomicAdd(rayStats.activeIters, iters);
+    uint maxIters = subgroupMax(iters);
+    if (subgroupElect())
+        atomicAdd(rayStats.laneIters, maxIters * gl_SubgroupSize);
+}
+
+//  LocalWords:  Pathtracing Raycasting
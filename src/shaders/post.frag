@@ -2,10 +2,9 @@
 
 layout(location = 0) out vec4 fragColor;
 
+// The tone mapped, sRGB encoded image, at the window size;  see tonemap.comp
 layout(set=0, binding=0) uniform sampler2D renderTarget;
 
 void main() {
-    vec2 uv = gl_FragCoord.xy / vec2(1280.0, 768.0);
-
-    fragColor = pow(texture(renderTarget, uv), vec4(1.0 / 2.2));
-}
\ No newline at end of file
+    fragColor = texelFetch(renderTarget, ivec2(gl_FragCoord.xy), 0);
+}
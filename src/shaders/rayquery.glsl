@@ -0,0 +1,32 @@
+// TraceRay and TraceShadowRay for pathtrace.glsl, cast with inline
+// ray queries.  Shared by the compute backends (raytrace.comp and
+// wavefront.comp).
+
+// Cast a path ray, and fill the payload as raytrace.rchit and
+// raytrace.rmiss would.
+void TraceRay(vec3 origin, vec3 direction)
+{
+    rayQueryEXT rq;
+    rayQueryInitializeEXT(rq, topLevelAS, gl_RayFlagsOpaqueEXT, 0xFF,
+                          origin, 0.001, direction, 10000.0);
+    while (rayQueryProceedEXT(rq)) {}
+
+    if (rayQueryGetIntersectionTypeEXT(rq, true) == gl_RayQueryCommittedIntersectionTriangleEXT) {
+        payload.hitDist = rayQueryGetIntersectionTEXT(rq, true);
+        payload.instanceIndex = uint(rayQueryGetIntersectionInstanceCustomIndexEXT(rq, true));
+        payload.primIndex = uint(rayQueryGetIntersectionPrimitiveIndexEXT(rq, true));
+        payload.bc = rayQueryGetIntersectionBarycentricsEXT(rq, true); }
+    else
+        payload.hitDist = -1.0;
+}
+
+bool TraceShadowRay(vec3 origin, vec3 direction, float tMax)
+{
+    rayQueryEXT rq;
+    rayQueryInitializeEXT(rq, topLevelAS,
+                          gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT, 0xFF,
+                          origin, 0.001, direction, tMax);
+    while (rayQueryProceedEXT(rq)) {}
+
+    return rayQueryGetIntersectionTypeEXT(rq, true) != gl_RayQueryCommittedIntersectionNoneEXT;
+}
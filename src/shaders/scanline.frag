@@ -21,6 +21,8 @@ layout(location=1) in vec3 worldPos;
 layout(location=2) in vec3 worldNrm;
 layout(location=3) in vec3 viewDir;
 layout(location=4) in vec2 texCoord;
+layout(location=5) flat in uint objIndex;    // See scanline.vert and scanlineIndirect.vert
+layout(location=6) flat in uint primOffset;
 // Outgoing
 layout(location = 0) out vec4 fragColor;
 
@@ -30,17 +32,21 @@ layout(buffer_reference, scalar) buffer Materials {Material m[]; }; // Array of
 layout(buffer_reference, scalar) buffer MatIndices {int i[]; };     // Material ID for each triangle
 
 layout(binding=1, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
-layout(binding=2) uniform sampler2D[] textureSamplers;
+
+// The textures, from the bindless table:  set 1 in every raster
+// pipeline layout this shader is part of.
+#define BINDLESS_SET 1
+#include "bindless.glsl"
 
 float pi = 3.14159;
 void main()
 {
   // Material of the object
-  ObjDesc    obj = objDesc.i[pcRaster.objIndex];
+  ObjDesc    obj = objDesc.i[objIndex];
   MatIndices matIndices  = MatIndices(obj.materialIndexAddress);
   Materials  materials   = Materials(obj.materialAddress);
   
-  int               matIndex = matIndices.i[gl_PrimitiveID];
+  int               matIndex = matIndices.i[primOffset + gl_PrimitiveID];
   Material mat      = materials.m[matIndex];
   
   vec3 N = normalize(worldNrm);
@@ -59,7 +65,7 @@ void main()
   {
     int  txtOffset  = obj.txtOffset;
     uint txtId      = txtOffset + mat.textureId;
-    Kd = texture(textureSamplers[nonuniformEXT(txtId)], texCoord).xyz;
+    Kd = texture(bindlessTextures[nonuniformEXT(txtId)], texCoord).xyz;
   }
   
   // This very minimal lighting calculation should be replaced with a modern BRDF calculation. 
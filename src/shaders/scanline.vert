@@ -26,6 +26,8 @@ layout(location = 1) out vec3 worldPos;
 layout(location = 2) out vec3 worldNrm;
 layout(location = 3) out vec3 viewDir;
 layout(location = 4) out vec2 texCoord;
+layout(location = 5) flat out uint objIndex;
+layout(location = 6) flat out uint primOffset;  // Of the draw's first triangle in the object
 
 out gl_PerVertex
 {
@@ -41,6 +43,8 @@ void main()
   viewDir  = vec3(eye - worldPos);
   texCoord = inTexCoord;
   worldNrm = mat3(pcRaster.modelMatrix) * inNormal;
+  objIndex = pcRaster.objIndex;
+  primOffset = 0;
 
   gl_Position = mats.viewProj * vec4(worldPos, 1.0);
 }
@@ -0,0 +1,59 @@
+#version 460
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_EXT_buffer_reference2 : require
+
+#include "shared_structs.h"
+
+// The GPU-driven raster's vertex shader:  scanline.vert, but with the
+// instance transform and object index taken from the CullInstance
+// that cull.comp made each draw's firstInstance.  The draws are not
+// indexed, and no vertex buffers are bound:  gl_VertexIndex runs over
+// the draw's range of the object's index buffer, and the vertex is
+// fetched through the object's ObjDesc addresses.  So every object's
+// draws go in one vkCmdDrawIndirectCount.
+
+layout(binding = 0) uniform _MatrixUniforms
+{
+  MatrixUniforms mats;
+};
+layout(binding = 1, scalar) buffer readonly ObjDesc_ { ObjDesc i[]; } objDesc;
+
+layout(set = 2, binding = 0, scalar) buffer readonly _CullInstances { CullInstance instances[]; };
+
+layout(buffer_reference, scalar) buffer readonly Vertices { Vertex v[]; };
+layout(buffer_reference, scalar) buffer readonly IndexList { uint i[]; };
+
+
+layout(location = 1) out vec3 worldPos;
+layout(location = 2) out vec3 worldNrm;
+layout(location = 3) out vec3 viewDir;
+layout(location = 4) out vec2 texCoord;
+layout(location = 5) flat out uint objIndex;
+layout(location = 6) flat out uint primOffset;
+
+out gl_PerVertex
+{
+  vec4 gl_Position;
+};
+
+
+void main()
+{
+  CullInstance inst = instances[gl_InstanceIndex];
+  ObjDesc obj = objDesc.i[inst.objIndex];
+  Vertex vtx = Vertices(obj.vertexAddress).v[IndexList(obj.indexAddress).i[gl_VertexIndex]];
+  vec3 eye = vec3(mats.viewInverse * vec4(0, 0, 0, 1));
+
+  worldPos = vec3(inst.transform * vec4(vtx.pos, 1.0));
+  viewDir  = vec3(eye - worldPos);
+  texCoord = vtx.texCoord;
+  worldNrm = mat3(inst.transform) * vtx.nrm;
+  objIndex = inst.objIndex;
+  primOffset = inst.firstIndex / 3;  // gl_PrimitiveID restarts at each draw
+
+  gl_Position = mats.viewProj * vec4(worldPos, 1.0);
+}
@@ -16,10 +16,14 @@ using uint = unsigned int;
 struct ObjDesc
 {
   int      txtOffset;             // Texture index offset in the array of textures
+  uint     materialBase;          // Index of the object's first material among all objects'
   uint64_t vertexAddress;         // Address of the Vertex buffer
   uint64_t indexAddress;          // Address of the index buffer
   uint64_t materialAddress;       // Address of the material buffer
   uint64_t materialIndexAddress;  // Address of the triangle material index buffer
+  uint64_t lodBiasAddress;        // Address of the triangle texture LOD bias buffer
+  uint64_t meshletVertexAddress;  // Address of the meshlets' vertex lists (see Meshlet in vkapp.h)
+  uint64_t meshletTriangleAddress;  // Address of each triangle's meshlet-local indices, packed
 };
 
 // An emitter
@@ -37,9 +41,10 @@ struct Emitter
 struct MatrixUniforms
 {
   mat4 viewProj;      // Camera view * projection
-  mat4 priorViewProj; // Camera view * projection
+  mat4 priorViewProj; // Camera view * projection, of the prior frame, unjittered
   mat4 viewInverse;   // Camera inverse view matrix
   mat4 projInverse;   // Camera inverse projection matrix
+  vec4 jitter;        // xy: sub-pixel jitter of viewProj and projInverse, in render pixels
 };
 
 #ifdef __cplusplus
@@ -77,6 +82,26 @@ struct PushConstantRaster
     ALIGNAS(4) uint  objIndex;     // index of instance
 };
 
+// Bindings of the bindless table (see vkapp_bindless.cpp and
+// bindless.glsl).  Resources are indexed by the handles VkApp's
+// bindless* functions return;  the textures' handles are their
+// indices in m_objText.
+#define BINDLESS_BUFFERS  0
+#define BINDLESS_IMAGES   1
+#define BINDLESS_TEXTURES 2  // Last: the variable count array
+
+// Push constant structure for the deferred raster's shading pass
+// (deferred.comp), and the ID it finds where nothing was drawn
+#define DEFERRED_NO_HIT 0xFFFFFFFFu
+struct PushConstantDeferred
+{
+    ALIGNAS(16) vec3 lightPos;
+    ALIGNAS(16) vec3 lightInt;
+    ALIGNAS(16) vec3 lightAmb;
+    ALIGNAS(4) int   width;      // Window size
+    ALIGNAS(4) int   height;
+};
+
 
 
 // Push constant structure for the ray tracer
@@ -94,7 +119,27 @@ struct PushConstantRay
     // @@ History:	 ...
     // @@ Denoise:	 ...
     ALIGNAS(4) bool clear;  // Tell the ray generation shader to start accumulation from scratch
-    ALIGNAS(4) float exposure;
+    ALIGNAS(4) int samplesPerLaunch; // Paths traced per pixel by each vkCmdTraceRaysKHR
+    ALIGNAS(4) bool adaptive;        // Use the variance-driven sample mask
+    ALIGNAS(4) int tileX;            // Origin of the launch's tile on screen
+    ALIGNAS(4) int tileY;
+    ALIGNAS(4) float coneSpread;     // Ray cone spread angle of one pixel
+    ALIGNAS(4) int wfBounce;         // Wavefront tracer: the bounce being extended and shaded
+    ALIGNAS(4) int width;            // Render size;  the images may be larger
+    ALIGNAS(4) int height;
+    ALIGNAS(4) int prevWidth;        // Last frame's render size, which the history has
+    ALIGNAS(4) int prevHeight;
+    ALIGNAS(4) bool hybrid;          // Primary hits come from the rasterized visibility buffer
+    ALIGNAS(4) bool history;         // The tile's history may be reprojected (see VkApp::raytrace)
+    ALIGNAS(4) bool carry;           // reproject.comp: the tile was not traced;  keep its history
+    // The history pairs' bindless storage image handles (see
+    // VkApp::createRtBuffers), swapped by the host before each trace
+    ALIGNAS(4) uint colCurr;         // rgba16f: mean color, sample count
+    ALIGNAS(4) uint colPrev;
+    ALIGNAS(4) uint ndCurr;          // rg32ui: normal:depth, packed by gbuffer.glsl
+    ALIGNAS(4) uint ndPrev;
+    ALIGNAS(4) uint momCurr;         // rg32f: mean squared luminance, first-hit flag
+    ALIGNAS(4) uint momPrev;
     ALIGNAS(4) int alignmentTest; // Set to a known value in C++;  Test in the shader!
 };
 
@@ -121,17 +166,258 @@ struct PushConstantDenoise
   float normFactor;
   float depthFactor;
   int  stepwidth;  
+  int   svgf;        // Variance-guided mode:  weight by luminance, filter the variance
+  float lumFactor;   // Luminance weight's width, in filtered standard deviations
+  int   minHistory;  // Samples below which the variance is estimated spatially
+  int   lastPass;    // Write this frame's output into the previous output image
+  int   measure;     // Accumulate the output's change since last frame into DenoiseStats
+  int   width;       // Render size;  the images may be larger
+  int   height;
+  // Bindless storage image handles:  the ray tracer's histories, and
+  // this pass's input and output, which VkApp::denoise swaps between
+  // passes
+  uint  ndImage;
+  uint  momImage;
+  uint  inImage;
+  uint  outImage;
+  uint  inVariance;
+  uint  outVariance;
+};
+
+// The denoiser's quality measure:  relative squared luminance change of
+// its output since the previous frame, summed over the screen in 16.16
+// fixed point, as a 64-bit count split across two words.
+struct DenoiseStats
+{
+  uint errLo;
+  uint errHi;
+};
+
+// Push constant structure for the TAA pass
+struct PushConstantTaa
+{
+  vec2  jitter;  // This frame's sub-pixel camera jitter, in render pixels
+  float blend;   // History weight given to a new sample centered on the output pixel
+  int   reset;   // No usable history:  output the current frame alone
+  vec2  renderSize;  // Size of the input;  the image may be larger
+  // Bindless storage image handles;  VkApp::taa swaps the last two
+  // each frame
+  uint  inImage;
+  uint  historyImage;
+  uint  outImage;
+};
+
+// Push constant structure for the spatial upscaler and sharpening passes
+struct PushConstantUpscale
+{
+  vec2  renderSize;  // Size of the upscaler's input;  the image may be larger
+  float sharpness;   // Sharpening strength, 0 (none) to 1
+  uint  inImage;     // Bindless storage image handle of the pass's input
+};
+
+// Tone mapping (histogram.comp, exposure.comp, tonemap.comp):  A
+// histogram of the HDR image's log2 luminance over [minLogLum,
+// minLogLum + logLumRange] in TM_LOG_BINS equal bins, 1..TM_BINS-1,
+// with bin 0 counting the black pixels.  Luminances outside the range
+// are clamped into its first or last bin.
+#define TM_BINS 256
+#define TM_LOG_BINS (TM_BINS - 1)
+
+struct PushConstantTonemap
+{
+  int   width;        // Size of the HDR image
+  int   height;
+  float minLogLum;    // log2 luminance of bin 1's lower edge
+  float logLumRange;  // log2 luminance covered by bins 1..TM_BINS-1
+  float adaptRate;    // Fraction of the way the exposure moves toward its target this frame
+  float exposure;     // Exposure compensation (a multiplier)
+  int   autoExposure; // 0: use exposure alone
 };
 
+// The histogram, and the exposure derived from it, which is kept from
+// frame to frame for temporal smoothing.  Read by the host after the
+// frame's fence.
+struct TonemapStats
+{
+  float avgLum;       // Smoothed scene luminance the exposure is set for;  0 before the first frame
+  float exposure;     // Multiplier applied before the filmic curve
+  uint  pixelCount;
+  uint  pad;
+  uint  histogram[TM_BINS];
+};
+
+// Largest sample count kept in the rgba16f color history (reproject.comp).
+// A pixel at the cap counts as converged (variance.comp).
+#define HISTORY_MAX_SAMPLES 2048.0
+
+// Push constant structure for building the adaptive sampling mask
+struct PushConstantVariance
+{
+  float threshold;   // Relative standard error below which a pixel has converged
+  int   minSamples;  // Samples a pixel needs before it may be declared converged
+  int   width;       // Render size;  the images may be larger
+  uint  colImage;    // Bindless storage image handles of the histories
+  uint  momImage;
+};
+
+// Per-frame counters written by the path tracers and read by the host
+struct RayStats
+{
+  uint rays;         // Rays cast
+  uint activeIters;  // Bounce iterations executed, summed over invocations
+  uint laneIters;    // Longest path's iterations times subgroup size, summed over subgroups
+};
+
+// Payload of the ray tracer's path rays, kept small to keep register
+// pressure down.  The hit position is not carried; the ray generation
+// shader recomputes it as origin + hitDist*direction.
 struct RayPayload
 {
-    uint seed;
-    bool hit;           // Does the ray intersect anything or not?
-    vec3 hitPos;	// The world coordinates of the hit point.      
-    float hitDist;
-    int instanceIndex;  // Index of the object instance hit (we have only one, so =0)
-    int primitiveIndex; // Index of the hit triangle primitive within object
-    vec3 bc;            // Barycentric coordinates of the hit point within triangle
+    uint  seed;
+    float hitDist;       // Distance to the hit point;  negative if nothing was hit
+    uint  instanceIndex; // Hit instance's custom index, which is its object's index
+    uint  primIndex;     // Hit triangle's index within the object
+    vec2  bc;            // Barycentric coordinates of the hit point's 2nd and 3rd vertex
+};
+
+// Wavefront path tracer (wavefront.comp):  Work is split into one
+// compute pass per stage, and passed between stages in buffers.
+#define WF_GROUP_SIZE 64    // Invocations per workgroup of the queue driven stages
+#define WF_BINS       1024  // Least material bins the shade queue is sorted by;  a power of two
+#define WF_MAX_BOUNCES 8
+
+// The state of one path in flight, indexed by its pixel
+struct WfPath
+{
+  vec3  origin;      // The path's next ray
+  vec3  dir;
+  vec3  W;           // Product of f/p weights so far
+  vec3  C;           // Radiance gathered so far
+  uint  seed;
+  int   depth;       // Bounces chosen by Russian roulette;  0 if no path this frame
+  float coneWidth;
+  float coneSpread;
+};
+
+// Where a path's current ray hit, as in RayPayload
+struct WfHit
+{
+  float hitDist;     // Negative if nothing was hit
+  uint  instanceIndex;
+  uint  primIndex;
+  vec2  bc;
+};
+
+// A path's first hit, kept for accumulation and reprojection
+struct WfFirstHit
+{
+  vec3  nrm;
+  float depth;
+  vec3  kd;
+  uint  hit;         // 0 if the primary ray missed
+  vec3  pos;
+  uint  instance;
+};
+
+// A deferred shadow ray, and the radiance it adds to its path if unoccluded
+struct WfShadowRay
+{
+  vec3  origin;
+  float tMax;
+  vec3  dir;
+  uint  path;
+  vec3  L;
+};
+
+// A queue's length, preceded by a VkDispatchIndirectCommand covering it
+struct WfQueue
+{
+  uint groupsX;
+  uint groupsY;
+  uint groupsZ;
+  uint count;
+};
+
+struct WfCounters
+{
+  WfQueue paths[2];  // Paths whose ray is to be extended;  alternates between bounces
+  WfQueue shade;     // Paths that hit something, sorted by material
+  WfQueue shadow;    // Shadow rays
+};
+
+// GPU-driven raster:  one mesh, or meshlet, of one instance, as tested
+// by cull.comp and drawn, if it survives, by scanlineIndirect.vert;  or
+// tested by meshlet.task and drawn by meshlet.mesh.
+struct CullInstance
+{
+  mat4 transform;    // The instance's
+  vec4 sphere;       // Bounding sphere in object space:  center, radius
+  vec4 cone;         // Normal cone in object space:  axis, cutoff (1:  none;  see Meshlet)
+  uint objIndex;
+  uint firstIndex;   // The range of the object's index buffer
+  uint indexCount;
+  uint vertexOffset; // A meshlet's range of the object's meshlet vertex lists
+  uint vertexCount;
+};
+
+// Meshlet limits, as suit most mesh shader hardware.  (Local vertex
+// indices are packed in 8 bits.)
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+// Threads of meshlet.task, each testing one CullInstance, and of
+// meshlet.mesh
+#define MESHLET_TASK_SIZE 32
+
+// Culling passes, for the two-phase occlusion culling of vkapp_cull.cpp
+#define CULL_FRUSTUM 0  // Frustum culling only, of every instance
+#define CULL_EARLY   1  // Those visible last frame, drawn before the depth pyramid is built
+#define CULL_LATE    2  // Every instance, against the pyramid;  draws those newly visible
+
+// Mip levels of the depth pyramid, at most
+#define HIZ_MAX_LEVELS 16
+
+struct PushConstantCull
+{
+  uint instanceCount;
+  uint phase;          // CULL_FRUSTUM, CULL_EARLY or CULL_LATE
+  int  hizLevels;      // Of the depth pyramid
+  int  width;          // Window size;  the pyramid's level 0
+  int  height;
+};
+
+// Per-frame counts of the culling passes, read by the host after the
+// frame's fence.  An instance drawn early may yet be occlusion culled
+// late, for the next frame.
+struct CullStats
+{
+  uint drawn;            // By either phase
+  uint drawnLate;
+  uint frustumCulled;
+  uint coneCulled;       // Facing away, by their normal cones
+  uint occlusionCulled;
+};
+
+// Push constant structure for the meshlet raster's task, mesh and
+// fragment shaders:  scanline.frag's lights, laid out as in
+// PushConstantRaster, then meshlet.task's culling pass.  (cull falls
+// at offset 44 in both C++ and GLSL.)
+struct PushConstantMeshlet
+{
+  ALIGNAS(16) vec3  scLightPos;
+  ALIGNAS(16) vec3  scLightInt;
+  ALIGNAS(16) vec3  scLightAmb;
+  PushConstantCull  cull;
+};
+
+// Push constant structure for building the depth pyramid
+struct PushConstantHiz
+{
+  int level;           // Being written;  0 reads the depth buffer
+  int width;           // Its size
+  int height;
+  int srcWidth;        // The size of the level read
+  int srcHeight;
 };
 
 #endif
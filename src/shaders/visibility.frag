@@ -0,0 +1,57 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_scalar_block_layout : enable
+
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_EXT_buffer_reference2 : require
+
+#include "shared_structs.h"
+
+// Hybrid rendering's visibility buffer (see vkapp_visibility.cpp):
+// each pixel's first hit, for PathTrace to start its paths from, in
+// place of the primary ray.  The texel holds what the closest hit
+// shader would put in the RayPayload:
+//   x: the instance index
+//   y: the triangle index, within the object
+//   z: the distance from the eye, as float bits;  0 if nothing was hit
+//   w: the barycentric coordinates of the 2nd and 3rd vertex, as two
+//      16 bit unorms (packUnorm2x16)
+
+layout(push_constant) uniform _PushConstantRaster
+{
+  PushConstantRaster pcRaster;
+};
+
+layout(location=1) in vec3 worldPos;
+layout(location=3) in vec3 viewDir;
+layout(location=5) flat in uint objIndex;    // See scanline.vert
+layout(location=6) flat in uint primOffset;
+
+layout(location = 0) out uvec4 visibility;
+
+layout(buffer_reference, scalar) buffer Vertices {Vertex v[]; };
+layout(buffer_reference, scalar) buffer Indices {ivec3 i[]; };
+
+layout(binding=1, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
+
+void main()
+{
+  uint prim = primOffset + gl_PrimitiveID;
+  ObjDesc  obj      = objDesc.i[objIndex];
+  Vertices vertices = Vertices(obj.vertexAddress);
+  ivec3    ind      = Indices(obj.indexAddress).i[prim];
+
+  // The barycentric coordinates of the interpolated position, on the
+  // triangle in world space.
+  vec3 a = vec3(pcRaster.modelMatrix * vec4(vertices.v[ind.x].pos, 1.0));
+  vec3 e1 = vec3(pcRaster.modelMatrix * vec4(vertices.v[ind.y].pos, 1.0)) - a;
+  vec3 e2 = vec3(pcRaster.modelMatrix * vec4(vertices.v[ind.z].pos, 1.0)) - a;
+  vec3 p = worldPos - a;
+  float d11 = dot(e1, e1), d12 = dot(e1, e2), d22 = dot(e2, e2);
+  float p1 = dot(p, e1), p2 = dot(p, e2);
+  float denom = max(d11*d22 - d12*d12, 1e-20);
+  vec2 bc = vec2(d22*p1 - d12*p2, d11*p2 - d12*p1) / denom;
+
+  visibility = uvec4(objIndex, prim, floatBitsToUint(length(viewDir)), packUnorm2x16(bc));
+}
@@ -27,6 +27,8 @@ VkApp::VkApp(App* _app) : app(_app)
     printf("SDK Version: %d.%d.%d\n", VK_API_VERSION_MAJOR(version),
            VK_API_VERSION_MINOR(version), VK_API_VERSION_PATCH(version));
 
+    preloadShaders();		// spv/* files, read in the background
+
     createInstance(app->doApiDump);	// -> m_instance
     assert (m_instance);
     createPhysicalDevice();		// -> m_physicalDevice i.e. the GPU
@@ -34,8 +36,11 @@ VkApp::VkApp(App* _app) : app(_app)
     createDevice();			// -> m_device
     getCommandQueue();		// -> m_queue
     createCommandPool();		// -> m_cmdPool
+    createRecordWorkers();		// -> m_recordWorkers, with -j N
     loadExtensions();		// Auto generated; loads namespace of all known extensions
+    createPipelineCache();		// -> m_pipelineCache, from last run's pipeline.cache
     getSurface();			// -> m_surface
+    startupPhase("device");
     
     createSwapchain();		// -> m_swapchain
     createDepthResource();		// -> m_depthImage, ...
@@ -43,8 +48,34 @@ VkApp::VkApp(App* _app) : app(_app)
     createPostFrameBuffers();	// -> m_framebuffers
 
     createRenderTarget();		// -> m_renderTarget
-    createPostDescriptor();		// -> m_postDesc
-    createPostPipeline();		// -> m_postPipelineLayout
+    createTonemapBuffers();		// -> m_displayBuffer, m_tonemapStatsBuff
+    createBindlessTable();		// -> m_bindlessDesc, empty
+
+    // Images at the render and window sizes, which the model does not
+    // affect;  the temporal passes' histories get bindless handles.
+    createRtBuffers();
+    createAdaptiveBuffers();
+    createDenoiseBuffer();
+    createUpscaleBuffers();
+    startupPhase("swapchain and images");
+
+    // Pipelines that depend on none of the model:  created on worker
+    // threads while the model loads (see vkapp_startup.cpp).
+    startupTask("post", [this]() {
+        createPostDescriptor();		// -> m_postDesc
+        createPostPipeline(); });	// -> m_postPipelineLayout
+    startupTask("denoise", [this]() {
+        createDenoiseDescriptorSet();
+        createDenoiseCompPipeline(); });
+    startupTask("upscale", [this]() {
+        createUpscaleDescriptorSet();
+        createUpscalePipelines(); });
+    startupTask("tone mapping", [this]() {	// HDR m_renderTarget -> m_displayBuffer
+        createTonemapDescriptorSet();
+        createTonemapPipelines(); });
+    startupTask("adaptive sampling", [this]() {	// Build the sample mask after each trace
+        createVarianceDescriptorSet();
+        createVariancePipeline(); });
 
     #ifdef GUI
     initGUI();
@@ -54,50 +85,103 @@ VkApp::VkApp(App* _app) : app(_app)
     loadModel();
     createMatrixBuffer();
     createObjDescriptionBuffer();
+    createMotionBuffers();
+    createBindlessTextures();		// m_objText -> m_bindlessDesc
+    startupPhase("model and textures");
     
     // Scanline: Initialize scanline capabilities
     createScRenderPass();
     createScDescriptorSet();
-    createScPipeline();
+    createCullBuffers();		// GPU-driven raster
+    createCullDescriptorSet();
+    createDeferredBuffers();		// Deferred raster
+    createDeferredDescriptorSet();
 
     // Raycasting ...: Initialize ray tracing capabilities
-    createRtBuffers();
     initRayTracing();
+    createVisibilityBuffers();  // Hybrid rendering's, read by the tracer
+    createRtDescriptorSet();  // All but the TLAS, written below
+    createWfBuffers();
+    createWfDescriptorSet();
+    createTaaBuffers();
+    startupPhase("model descriptor sets");
+
+    // Pipelines whose layouts include the model's descriptor sets:
+    // created while the acceleration structures build.
+    startupTask("scanline", [this]() { createScPipeline(); });
+    startupTask("visibility", [this]() { createVisibilityPipeline(); });
+    startupTask("cull", [this]() { createCullPipeline(); });
+    startupTask("deferred", [this]() { createDeferredPipelines(); });
+    startupTask("ray tracing", [this]() { createRtPipeline(); });
+    if (m_rayQuery) {
+        startupTask("ray query", [this]() { createRqPipeline(); });
+        startupTask("wavefront", [this]() { createWfPipelines(); }); }
+    startupTask("reproject", [this]() { createReprojectPipeline(); });
+    startupTask("taa", [this]() {
+        createTaaDescriptorSet();
+        createTaaPipeline(); });
+
     createRtAccelerationStructure();
-    createRtDescriptorSet();
-    createRtPipeline();
-    createRtShaderBindingTable();
+    m_rtDesc.write(m_device, 0, m_rtBuilder.getAccelerationStructure());
+    startupPhase("acceleration structures");
 
-    // Denoising: Initialize denoising capabilities
-    createDenoiseBuffer();
-    createDenoiseDescriptorSet();
-    createDenoiseCompPipeline();
+    joinStartupTasks();
+    createRtShaderBindingTable();  // From m_rtPipeline
+
+    // Timing: GPU timestamps for the frame and its passes
+    createTimestampQueries();
+    startupPhase("shader binding table");
+    reportStartup();
 
+    if (app->descriptorBenchmark)
+        benchmarkDescriptorUpdates();  // Before any frame swaps the history handles
 }
 
 void VkApp::drawFrame()
 {
      prepareFrame();
+     readTimestamps();  // The previous frame's, now that its fence has signaled
     
      VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
      vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+     vkCmdResetQueryPool(m_commandBuffer, m_timestampPool, 0, TS_COUNT);
+     vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         m_timestampPool, TS_FRAME_BEGIN);
     
     {   // Extra indent for code clarity
+        if (useRaytracer)
+            updateRenderSize();  // Before the camera's jitter, which depends on it
         updateCameraBuffer();
+        updateInstanceMotion();
+        updateInstanceTransforms();
         
         // Draw scene
         if (useRaytracer) {
              raytrace();
              denoise();
-         } else
+             if (useSpatialUpscaler) {
+                 upscale();
+                 m_taaReset = true; }  // TAA's history is not last frame's
+             else
+                 taa();
+             sharpen();
+         } else {
              rasterize();
+             m_taaReset = true; }
         
-        postProcess(); //  tone mapper and output to swapchain image.
+        tonemap();      // Auto-exposure and tone mapping, into m_displayBuffer
+        postProcess();  // Output to swapchain image, and UI
     }   // Done recording;  Execute!
     
+    vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        m_timestampPool, TS_FRAME_END);
     vkEndCommandBuffer(m_commandBuffer);
     submitFrame();  // Submit for display
+
+    if (m_firstFrame) {
+        printf("Time to first frame: %.1f ms\n", float(glfwGetTime() - m_startupBegin) * 1000.0f);
+        m_firstFrame = false; }
 }
 
 
@@ -180,6 +264,48 @@ void VkApp::submitFrame()
     printf("Frame submitted and presented successfully.\n");
 }
 
+// A pool of TS_COUNT timestamp queries used to time the frame and
+// its passes on the GPU.
+void VkApp::createTimestampQueries()
+{
+    m_timestampPeriod = m_deviceProperties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    poolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = TS_COUNT;
+    if (vkCreateQueryPool(m_device, &poolInfo, nullptr, &m_timestampPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create timestamp query pool!"); }
+    NAME(m_timestampPool, VK_OBJECT_TYPE_QUERY_POOL, "m_timestampPool");
+
+    // Queries must be reset before they are first written or read.
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    vkCmdResetQueryPool(cmdBuf, m_timestampPool, 0, TS_COUNT);
+    submitTempCmdBuffer(cmdBuf);
+
+    m_timestamps.assign(TS_COUNT, 0);
+}
+
+void VkApp::readTimestamps()
+{
+    // Results come back as (value, availability) pairs.  Queries not
+    // written last frame (e.g. the trace while rasterizing) read as 0.
+    std::vector<uint64_t> results(2*TS_COUNT, 0);
+    vkGetQueryPoolResults(m_device, m_timestampPool, 0, TS_COUNT,
+                          results.size()*sizeof(uint64_t), results.data(), 2*sizeof(uint64_t),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    
+    for (uint32_t i=0;  i<TS_COUNT;  i++)
+        m_timestamps[i] = results[2*i+1] ? results[2*i] : 0;
+}
+
+// GPU time in milliseconds between two of last frame's timestamps,
+// or 0 if either was not written.
+float VkApp::timestampMs(TimestampSlot begin, TimestampSlot end)
+{
+    if (m_timestamps[begin] == 0 || m_timestamps[end] == 0)
+        return 0.0f;
+    return float(m_timestamps[end] - m_timestamps[begin]) * m_timestampPeriod * 1e-6f;
+}
 
 VkShaderModule VkApp::createShaderModule(std::string code)
 {
@@ -232,7 +358,7 @@ void VkApp::initGUI()
     init_info.Device                    = m_device;
     init_info.QueueFamily               = m_graphicsQueueIndex;
     init_info.Queue                     = m_queue;
-    init_info.PipelineCache             = VK_NULL_HANDLE;
+    init_info.PipelineCache             = m_pipelineCache;
     init_info.DescriptorPool            = m_imguiDescPool;
     init_info.Subpass                   = subpassID;
     init_info.MinImageCount             = 2;
@@ -241,7 +367,9 @@ void VkApp::initGUI()
     init_info.CheckVkResultFn           = nullptr;
     init_info.Allocator                 = nullptr;
 
-    ImGui_ImplVulkan_Init(&init_info, m_postRenderPass);
+    double start = glfwGetTime();
+    ImGui_ImplVulkan_Init(&init_info, m_postRenderPass);  // Creates its pipeline
+    logPipelineTime("ImGui", start);
 
     // Upload Fonts
     VkCommandBuffer cmdbuf = createTempCmdBuffer();
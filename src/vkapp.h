@@ -2,6 +2,16 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <condition_variable>
+#include <vector>
 #include "vulkan/vulkan_core.h"
 //#include <vulkan/vulkan.hpp>  // A modern C++ API for Vulkan. Beware 14K lines of code
    
@@ -37,6 +47,37 @@
 #define GLM_SWIZZLE
 #include <glm/glm.hpp>
 
+// A mesh of an object, as read from the model file:  a range of the
+// object's index buffer and its bounding sphere, in object space.
+// The GPU-driven raster culls and draws each separately.
+struct MeshRange
+{
+    glm::vec4 sphere;       // Center, radius
+    uint32_t  firstIndex;
+    uint32_t  indexCount;
+};
+
+// A meshlet of a mesh, as built at load time:  a run of the mesh's
+// triangles using at most MESHLET_MAX_VERTICES vertices, up to
+// MESHLET_MAX_TRIANGLES of them.  Being a run, its triangles are a
+// range of the index buffer, as a MeshRange's;  for the mesh shader,
+// its vertices are also listed in the object's meshletVertexBuffer,
+// and each triangle's indices into that list packed in its
+// meshletTriangleBuffer.  The normal cone bounds the triangles'
+// normals:  all face away from an eye where
+//     dot(center - eye, axis) >= cutoff * length(center - eye) + radius,
+// cutoff being the sine of the cone's half angle;  1 if that is 90
+// degrees or more.
+struct Meshlet
+{
+    glm::vec4 sphere;       // Center, radius
+    glm::vec4 cone;         // Axis, cutoff
+    uint32_t  firstIndex;
+    uint32_t  indexCount;
+    uint32_t  vertexOffset; // Its range of meshletVertexBuffer
+    uint32_t  vertexCount;
+};
+
 // The OBJ model: Vulkan buffers of object data
 struct ObjData
 {
@@ -46,6 +87,11 @@ struct ObjData
     BufferWrap indexBuffer;     // Buffer of triangle indices
     BufferWrap matColorBuffer;  // Buffer of materials
     BufferWrap matIndexBuffer;  // Buffer of each triangle's material index
+    BufferWrap lodBiasBuffer;   // Buffer of each triangle's texture LOD bias
+    std::vector<MeshRange> meshes;  // Partition of the index buffer
+    std::vector<Meshlet> meshlets;  // Finer partition of the index buffer
+    BufferWrap meshletVertexBuffer;    // Buffer of each meshlet's vertex indices
+    BufferWrap meshletTriangleBuffer;  // Buffer of each triangle's meshlet-local indices, packed
 };
 
 #define NAME(handle, objType, name)  { \
@@ -62,9 +108,42 @@ struct ObjData
 struct ObjInst
 {
     glm::mat4 transform;    // Matrix of the instance
+    glm::mat4 prevTransform; // Its matrix in the previous frame, for motion vectors
     uint32_t  objIndex;     // Model index
 };
 
+// What the GPU-driven raster culls:  a CullInstance per mesh, or per
+// meshlet, of each instance, grouped by object, and the indirect draws
+// and counts that cull.comp makes of them.  See vkapp_cull.cpp.
+struct CullList
+{
+    const char*    name = "";       // "meshes" or "meshlets"
+    BufferWrap     instanceBuff{};  // CullInstance's
+    BufferWrap     drawBuff{};      // VkDrawIndirectCommand's:  early, then late
+    BufferWrap     countBuff{};     // Draw counts:  early, then late
+    BufferWrap     visibleBuff{};   // Per CullInstance:  visible as of the last late pass
+    uint32_t       instanceCount = 0;
+    DescriptorWrap desc{};
+};
+
+// What distinguishes the samplers VkApp::acquireSampler shares:
+// filtering, address mode (of all of U, V and W), anisotropy (0 for
+// none) and LOD range.  The rest of VkSamplerCreateInfo is left at
+// its defaults.
+struct SamplerKey
+{
+    VkFilter             filter = VK_FILTER_LINEAR;
+    VkSamplerMipmapMode  mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    float                maxAnisotropy = 0.0f;
+    float                minLod = 0.0f;
+    float                maxLod = VK_LOD_CLAMP_NONE;
+
+    bool operator<(const SamplerKey& o) const {
+        return std::tie(filter, mipmapMode, addressMode, maxAnisotropy, minLod, maxLod)
+            < std::tie(o.filter, o.mipmapMode, o.addressMode, o.maxAnisotropy, o.minLod, o.maxLod); }
+};
+
 uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
 class App;
@@ -110,6 +189,7 @@ public:
     void createInstance(bool doApiDump);
 
     VkPhysicalDevice m_physicalDevice{};
+    VkPhysicalDeviceProperties m_deviceProperties{};  // Its limits, queried once
     void createPhysicalDevice();
 
     uint32_t m_graphicsQueueIndex{VK_QUEUE_FAMILY_IGNORED};
@@ -126,6 +206,38 @@ public:
     VkSurfaceKHR m_surface{};
     void getSurface();
     
+    // Persistent pipeline cache, shared by every pipeline creation;
+    // see vkapp_pipelineCache.cpp.
+    VkPipelineCache m_pipelineCache{VK_NULL_HANDLE};
+    bool  m_pipelineCacheWarm = false;  // Loaded from the last run
+    int   m_pipelineCount = 0;
+    float m_pipelineCreateMs = 0.0f;
+    std::mutex m_pipelineTimeMutex;     // Pipelines are created by startup tasks
+    void createPipelineCache();
+    void logPipelineTime(const char* name, double start);
+    void savePipelineCache();
+
+    // Startup task graph:  pipelines are created on worker threads
+    // while the main thread loads the model and builds the
+    // acceleration structures;  see vkapp_startup.cpp.
+    struct StartupTask {
+        const char* name;
+        std::future<float> done;  // Its time, in ms
+    };
+    std::vector<StartupTask> m_startupTasks;
+    std::map<std::string, std::future<std::string>> m_shaderFiles;  // Being preloaded
+    std::mutex m_shaderFilesMutex;
+    double m_startupBegin = 0.0;
+    double m_phaseBegin = 0.0;
+    bool   m_firstFrame = true;
+    std::vector<std::pair<std::string, float>> m_startupPhaseMs;
+    std::vector<std::pair<std::string, float>> m_startupTaskMs;
+    void preloadShaders();
+    void startupTask(const char* name, std::function<void()> work);
+    void joinStartupTasks();
+    void startupPhase(const char* name);
+    void reportStartup();
+
     VkCommandPool m_cmdPool{VK_NULL_HANDLE};
     VkCommandBuffer m_commandBuffer{};
     void createCommandPool();
@@ -139,6 +251,8 @@ public:
     VkSemaphore m_readSemaphore{};
     VkSemaphore m_writtenSemaphore{};
     VkExtent2D m_windowSize{0, 0}; // Size of the window
+    VkExtent2D m_renderSize{0, 0}; // Size the path tracer renders at;  see vkapp_taa.cpp
+    VkExtent2D m_maxRenderSize{0, 0}; // Size its images are allocated at;  see vkapp_upscale.cpp
     void createSwapchain();
 
 
@@ -161,29 +275,132 @@ public:
     #endif
     
     VkRenderPass m_scRenderPass{VK_NULL_HANDLE};
+    VkRenderPass m_scLateRenderPass{VK_NULL_HANDLE};  // Occlusion culling's second pass:  loads
     VkFramebuffer m_scFramebuffer{VK_NULL_HANDLE};
     void createScRenderPass();
 
+    // Packed formats of the screen-sized images.  Each MUST match the
+    // format qualifier of the image's shader declarations.
+    static constexpr VkFormat colorFormat  = VK_FORMAT_R16G16B16A16_SFLOAT; // rgba16f: color and its history
+    static constexpr VkFormat kdFormat     = VK_FORMAT_R8G8B8A8_UNORM;      // rgba8: albedo
+    static constexpr VkFormat ndFormat     = VK_FORMAT_R32G32_UINT;         // rg32ui: see gbuffer.glsl
+    static constexpr VkFormat momentFormat = VK_FORMAT_R32G32_SFLOAT;       // rg32f: second moment, hit flag
+    static constexpr VkFormat maskFormat   = VK_FORMAT_R16_SFLOAT;          // r16f: sample multiplier
+    static constexpr VkFormat motionFormat = VK_FORMAT_R16G16_SFLOAT;       // rg16f: motion in pixels
+    static constexpr VkFormat varianceFormat = VK_FORMAT_R32_SFLOAT;        // r32f: denoiser's luminance variance
+    static constexpr VkFormat displayFormat = VK_FORMAT_R8G8B8A8_UNORM;     // rgba8: tone mapped, sRGB encoded
+    static constexpr VkFormat visibilityFormat = VK_FORMAT_R32G32B32A32_UINT;  // rgba32ui: see visibility.frag
+    static constexpr VkFormat idFormat     = VK_FORMAT_R32G32_UINT;         // rg32ui: see deferredId.frag
+
     ImageWrap m_renderTarget{};
     void createRenderTarget();
 
     void destroyRaytracingResources();
     void destroyDenoiseResources();
     
-    ImageWrap m_rtColCurrBuffer{}; 
-    ImageWrap m_rtColPrevBuffer{};
-    
-    ImageWrap m_rtKdCurrBuffer{};
-    ImageWrap m_rtKdPrevBuffer{};
-    
-    ImageWrap m_rtNdCurrBuffer{};
-    ImageWrap m_rtNdPrevBuffer{};
+    // The path tracer's history pairs (color, normal:depth, and the
+    // moments of m_rtMomBuffer), which swap roles each traced frame:
+    // m_pcRay's colCurr, colPrev, ... hold their bindless handles.
+    // The first hit's albedo has no history.
+    ImageWrap m_rtColBuffer[2]{};
+    ImageWrap m_rtNdBuffer[2]{};
+    ImageWrap m_rtKdBuffer{};
     
     void createRtBuffers();
     
-    ImageWrap m_denoiseBuffer{};
+    // The A-Trous passes' ping-pong pair, by bindless handle, and the
+    // handle of whichever image holds this frame's denoised output
+    ImageWrap m_denoiseBuffer[2]{};
+    uint32_t  m_denoiseHandles[2] = {0, 0};
+    uint32_t  m_denoiseOutput = 0;
     void createDenoiseBuffer();
 
+    // Variance-guided (SVGF style) denoising:  the luminance variance
+    // of each pixel, estimated by estimateVariance.comp and filtered by
+    // each A-Trous pass along with the color, ping-ponged like it.
+    // Also last frame's denoised output, against which the quality
+    // measure is taken.
+    ImageWrap m_denoiseVarBuffer[2]{};
+    uint32_t  m_denoiseVarHandles[2] = {0, 0};
+    ImageWrap m_denoisePrevBuffer{};
+    BufferWrap    m_denoiseStatsBuff{};
+    DenoiseStats* m_denoiseStats = nullptr;  // Mapped
+
+    // Motion vectors:  The path tracer writes each pixel's first hit's
+    // screen-space motion since the previous frame, from the camera's
+    // and the hit instance's previous transforms.  reproject.comp then
+    // blends the new samples with the history it points to.  Any pass
+    // that needs last frame's position of a pixel reads m_motionBuffer.
+    ImageWrap  m_motionBuffer{};
+    BufferWrap m_instanceMotionBuff{};  // Per instance: prevTransform * inverse(transform)
+    BufferWrap m_instanceTransformBuff{};  // Per instance: transform
+    BufferWrap m_instanceTransformStaging{};  // Host-visible, copied into it
+    glm::mat4* m_instanceTransforms = nullptr;  // Mapped m_instanceTransformStaging
+    void createMotionBuffers();
+    void updateInstanceMotion();
+    void updateInstanceTransforms();
+
+    // Hybrid rendering (-P, toggled with the P key):  the raster draws
+    // each pixel's first hit into m_visibilityBuffer, from which the
+    // path tracer starts its paths without tracing the primary ray.
+    // See vkapp_visibility.cpp.
+    ImageWrap        m_visibilityBuffer{};
+    ImageWrap        m_visibilityDepth{};
+    VkRenderPass     m_visibilityRenderPass{};
+    VkFramebuffer    m_visibilityFramebuffer{};
+    VkPipelineLayout m_visibilityPipelineLayout{};
+    VkPipeline       m_visibilityPipeline{};
+    void createVisibilityBuffers();
+    void createVisibilityPipeline();
+    void rasterizeVisibility();
+
+    VkPipelineLayout m_reprojectPipelineLayout{};
+    VkPipeline       m_reprojectPipeline{};
+    void createReprojectPipeline();
+    void reproject(const std::vector<PushConstantRay>& tiles, int tileSize);
+
+    // Temporal anti-aliasing and upsampling:  taa.comp resolves the
+    // denoised image, at m_renderSize, into an image at m_windowSize,
+    // blended with last frame's result.  m_upscaleBuffer and
+    // m_taaHistory take turns as the two;  m_pcTaa holds their handles.
+    ImageWrap        m_taaHistory{};
+    DescriptorWrap   m_taaDesc{};
+    VkPipelineLayout m_taaPipelineLayout{};
+    VkPipeline       m_taaPipeline{};
+    PushConstantTaa  m_pcTaa{};
+    int              m_taaFrame = 0;     // Jitter sequence position
+    bool             m_taaReset = true;  // No history, or not last frame's, or at another render size
+    void createTaaBuffers();
+    void createTaaDescriptorSet();
+    void createTaaPipeline();
+    glm::vec2 taaJitter();
+    void taa();
+
+    // Spatial upscaling and dynamic resolution:  upscale.comp resizes
+    // the denoised image, at m_renderSize, into m_upscaleBuffer at
+    // m_windowSize (or taa.comp does, temporally), and sharpen.comp
+    // sharpens that, by handle m_upscaleOutput, into m_renderTarget.
+    // updateRenderSize varies m_renderSize, within m_maxRenderSize, to
+    // hold app->targetFrameMs.
+    ImageWrap        m_upscaleBuffer{};
+    uint32_t         m_upscaleHandle = 0;
+    uint32_t         m_upscaleOutput = 0;
+    DescriptorWrap   m_upscaleDesc{};
+    VkPipelineLayout m_upscalePipelineLayout{};
+    VkPipeline       m_upscalePipeline{};
+    VkPipeline       m_sharpenPipeline{};
+    PushConstantUpscale m_pcUpscale{};
+    float            m_renderScale = 1.0f;   // m_renderSize / m_windowSize
+    float            m_resizeFrameMs = 0.0f; // Averaged frame time
+    int              m_framesSinceResize = 0;
+    bool             m_renderSizeChanged = false;
+    void createUpscaleBuffers();
+    void createUpscaleDescriptorSet();
+    void createUpscalePipelines();
+    void updateRenderSize();
+    void upscale();
+    void sharpen();
+
     // Various model specific parameters
     vec3 scLightInt;
     vec3 scLightPos;
@@ -192,6 +409,7 @@ public:
     // Arrays of objects instances and textures in the scene
     std::vector<ObjData>  m_objData{};  // Obj data in Vulkan Buffers
     std::vector<ObjDesc>  m_objDesc{};  // Device-addresses of those buffers
+    uint32_t m_materialCount = 0;       // All objects' materials (see ObjDesc::materialBase)
     std::vector<ImageWrap>  m_objText{}; // All textures of the scene
     std::vector<ObjInst>  m_objInst{}; // Instances paring an object and a transform
     BufferWrap m_lightBuff{};          // Buffer of light list
@@ -201,6 +419,17 @@ public:
     BufferWrap m_objDescriptionBuff{};  // Device buffer of the OBJ descriptions
     void createObjDescriptionBuffer();
 
+    // The bindless table (vkapp_bindless.cpp):  storage buffers,
+    // storage images and textures, indexed in shaders by handle.
+    DescriptorWrap m_bindlessDesc{};
+    uint32_t m_bindlessCount[3] = {0, 0, 0};  // Handles given out, per binding
+    void createBindlessTable();
+    void createBindlessTextures();      // Once the model is loaded
+    uint32_t bindlessBuffer(const VkBuffer& buffer);
+    uint32_t bindlessStorageImage(const ImageWrap& image);
+    uint32_t bindlessTexture(const ImageWrap& texture);
+    void bindlessStorageImage(uint32_t handle, const ImageWrap& image);
+
     DescriptorWrap m_scDesc{};
     void createScDescriptorSet();
 
@@ -208,11 +437,168 @@ public:
     VkPipeline                  m_scPipeline{};
     void createScPipeline();
 
+    // GPU-driven raster (-G, toggled with the G key):  cull.comp tests
+    // each mesh of each instance against the view frustum, appending
+    // the survivors' draws to the CullList's drawBuff and counting them
+    // per object in its countBuff.  drawCulled then draws them with one
+    // vkCmdDrawIndexedIndirectCount per object, so the CPU's cost does
+    // not grow with the instance count.  See vkapp_cull.cpp.
+    //
+    // With -M (toggled with the M key), it culls meshlets instead, also
+    // by their normal cones, and rasterizes with back-face culling.
+    // Where the device has mesh shaders (unless -F), meshlet.task culls
+    // and meshlet.mesh draws them, with one vkCmdDrawMeshTasksEXT.
+    bool             m_drawIndirectCount = false;  // Device supports vkCmdDrawIndexedIndirectCount
+    bool             m_meshShader = false;  // Device supports VK_EXT_mesh_shader's task and mesh shaders
+    VkPipelineStageFlags m_cullStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;  // That run the culling tests
+    CullList         m_cullMeshes{};
+    CullList         m_cullMeshlets{};
+    BufferWrap       m_cullStatsBuff{};
+    CullStats*       m_cullStats = nullptr;  // Mapped m_cullStatsBuff
+    bool             m_cullStatsPending = false;
+    VkPipelineLayout m_cullPipelineLayout{};
+    VkPipeline       m_cullPipeline{};
+    VkPipelineLayout m_scIndirectPipelineLayout{};  // Sets m_scDesc and a CullList's desc
+    VkPipeline       m_scIndirectPipeline{};
+    VkPipelineLayout m_meshletPipelineLayout{};     // Likewise
+    VkPipeline       m_meshletPipeline{};
+    void createCullBuffers();
+    void createCullList(CullList& list, const char* name, bool meshlets);
+    void createCullDescriptorSet();
+    void createCullPipeline();
+    PushConstantCull cullParams(const CullList& list, uint32_t phase);
+    void beginCull(CullList& list);
+    void cull(CullList& list, uint32_t phase);
+    void drawCulled(CullList& list, uint32_t phase, bool meshShader);
+    void endCull();
+
+    // Two-phase occlusion culling (unless -O, toggled with the O key):
+    // the early pass draws what was visible last frame;  buildHiz
+    // reduces its depth to a pyramid of farthest depths;  the late
+    // pass tests everything against that, and draws what is newly
+    // visible.  Needs a depth format that can be sampled.
+    bool             m_hizSupported = false;
+    ImageWrap        m_hizImage{};          // R32F, every level in its imageView
+    std::vector<VkImageView> m_hizLevelViews{};  // Each level's, for hiz.comp to write
+    int              m_hizLevels = 0;
+    DescriptorWrap   m_hizDesc{};
+    VkPipelineLayout m_hizPipelineLayout{};
+    VkPipeline       m_hizPipeline{};
+    void buildHiz();
+
+    // Deferred raster (-I, toggled with the I key):  the instances are
+    // drawn into m_idBuffer, a packed object and triangle index per
+    // pixel, and deferred.comp shades each pixel once from there.  See
+    // vkapp_deferred.cpp.
+    ImageWrap        m_idBuffer{};
+    VkRenderPass     m_idRenderPass{};
+    VkFramebuffer    m_idFramebuffer{};
+    VkPipelineLayout m_idPipelineLayout{};
+    VkPipeline       m_idPipeline{};
+    DescriptorWrap   m_deferredDesc{};
+    VkPipelineLayout m_deferredPipelineLayout{};
+    VkPipeline       m_deferredPipeline{};
+    void createDeferredBuffers();
+    void createDeferredDescriptorSet();
+    void createDeferredPipelines();
+    void rasterizeDeferred();
+
+    // The raster's CPU recording time and culling counts, reported
+    // once per second.
+    int      m_rasterReportFrames = 0;
+    double   m_rasterReportStart = 0.0;
+    double   m_rasterReportCpuMs = 0.0;
+    double   m_rasterReportWorkerMs = 0.0;
+    uint64_t m_rasterReportDrawn = 0;
+    uint64_t m_rasterReportDrawnLate = 0;
+    uint64_t m_rasterReportCulled = 0;
+    uint64_t m_rasterReportConeCulled = 0;
+    uint64_t m_rasterReportOccluded = 0;
+    std::string m_rasterReportMode{};  // The window's
+    void readCullStats();
+    void reportRaster(const std::string& mode, const CullList* list, double cpuMs, double workerMs = 0.0);
+
+    // Parallel recording of the per-instance raster (-j N):  each
+    // worker thread records a range of m_objInst into its own
+    // secondary command buffer, from its own pool.  See
+    // vkapp_recording.cpp.
+    struct RecordWorker {
+        VkCommandPool   pool{VK_NULL_HANDLE};
+        VkCommandBuffer cmdBuf{VK_NULL_HANDLE};  // Secondary, within m_scRenderPass
+        std::thread     thread;
+        double          ms = 0.0;  // Its last recording time
+    };
+    std::vector<RecordWorker> m_recordWorkers{};  // None when recording inline
+    std::mutex              m_recordMutex;
+    std::condition_variable m_recordStart;  // m_recordFrame advanced, or m_recordQuit
+    std::condition_variable m_recordDone;   // m_recordPending reached 0
+    uint64_t m_recordFrame = 0;
+    int      m_recordPending = 0;
+    bool     m_recordQuit = false;
+    void createRecordWorkers();
+    void destroyRecordWorkers();
+    void recordWorker(int index);
+    void recordInstanceDraws(VkCommandBuffer cmdBuf, size_t first, size_t end);
+    double recordInstancesParallel();
+
     BufferWrap m_matrixBuff{};  // Device-Host of the camera matrices
     void   createMatrixBuffer();
     
     float m_maxAnis = 0;
     PushConstantRay m_pcRay{};  // Push constant for ray tracer
+
+    // Samples per launch: each vkCmdTraceRaysKHR traces
+    // m_pcRay.samplesPerLaunch paths per pixel.  Unless fixed from the
+    // command line, the count is adjusted every frame to hold the GPU
+    // frame time near m_targetFrameMs.
+    bool  m_fixedSamples = false;
+    int   m_maxSamplesPerLaunch = 64;
+    float m_targetFrameMs = 16.0f;
+    float m_msPerSample = 0.0f;    // Smoothed trace cost of one sample per pixel
+    void updateSamplesPerLaunch();
+
+    // Tiled dispatch: each frame traces m_tilesPerFrame tiles of
+    // m_tileSize^2 pixels, continuing round-robin from m_nextTile in
+    // the next frame.  The tile count is adjusted to hold the GPU frame
+    // time near m_targetFrameMs, so no single frame stalls on a
+    // full-screen launch.
+    bool  useTiledDispatch = false;
+    int   m_tileSize = 256;
+    int   m_nextTile = 0;
+    int   m_tilesPerFrame = 1;
+    int   m_tilesTraced = 0;       // Tiles traced by the last frame
+    int   m_clearTiles = 0;        // Tiles left to trace with accumulation cleared
+    // The camera each tile's history was traced with, as a count of
+    // camera moves (-1: none).  Only a tile traced with last frame's
+    // camera may be reprojected;  any other's history is stale.
+    std::vector<int> m_tileCamera;
+    int   m_cameraMoves = 0;
+    int   m_priorCamera = 0;       // m_cameraMoves as of the previous frame
+    float m_msPerTile = 0.0f;      // Smoothed trace cost of one tile
+    void updateTilesPerFrame(int tileCount);
+
+    // Adaptive sampling: the ray tracer accumulates each pixel's mean
+    // luminance^2 next to its color; a compute pass turns the two into
+    // m_sampleMask (0: converged, skip; 1: normal; 2: double samples)
+    // and counts the pixels still active into m_adaptiveStatsBuff.
+    bool  useAdaptiveSampling = true;
+    float m_convergenceThreshold = 0.01f;  // Relative standard error
+    int   m_minAdaptiveSamples = 16;       // Before a pixel may converge
+    ImageWrap  m_rtMomBuffer[2]{};  // A history pair, as m_rtColBuffer
+    ImageWrap  m_sampleMask{};
+    BufferWrap m_adaptiveStatsBuff{};
+    uint32_t*  m_adaptiveStats = nullptr;  // Mapped m_adaptiveStatsBuff
+    uint32_t   m_activePixels = 0;
+    void createAdaptiveBuffers();
+    void readAdaptiveStats();
+
+    DescriptorWrap   m_varianceDesc{};
+    VkPipelineLayout m_variancePipelineLayout{};
+    VkPipeline       m_variancePipeline{};
+    void createVarianceDescriptorSet();
+    void createVariancePipeline();
+    void buildSampleMask();
+
     int m_num_atrous_iterations = 5;
     PushConstantDenoise m_pcDenoise{};
     uint32_t handleSize{};
@@ -232,10 +618,72 @@ public:
     // Raytrace descriptor set objects and functions
     DescriptorWrap m_rtDesc{};
     void createRtDescriptorSet();
+    void benchmarkDescriptorUpdates();  // -B;  see vkapp_descriptorUpdates.cpp
 
     VkPipelineLayout m_rtPipelineLayout{};
     VkPipeline       m_rtPipeline{};
     void createRtPipeline();
+
+    // Ray query backend: the same path tracer run as a compute shader
+    // (raytrace.comp) with inline ray queries, selected with -q.
+    // Its pipelines, and the wavefront tracer's, are made only where
+    // the device has VK_KHR_ray_query.
+    bool useRayQuery = false;
+    bool m_rayQuery = false;  // Device supports VK_KHR_ray_query
+    VkPipelineLayout m_rqPipelineLayout{};
+    VkPipeline       m_rqPipeline{};
+    void createRqPipeline();
+
+    // Rays cast and lane utilization of either backend, counted on
+    // the GPU each frame, and summed into a report once per second.
+    BufferWrap m_rayStatsBuff{};
+    RayStats*  m_rayStats = nullptr;   // Mapped m_rayStatsBuff
+    bool       m_rayStatsPending = false;
+    uint64_t   m_reportRays = 0;
+    uint64_t   m_reportActiveIters = 0;
+    uint64_t   m_reportLaneIters = 0;
+    int        m_reportFrames = 0;
+    float      m_reportTraceMs = 0.0f;
+    float      m_reportReprojectMs = 0.0f;
+    double     m_reportStart = 0.0;
+    void reportTraceRate();
+
+    // Wavefront path tracer (wavefront.comp), selected with -w: the
+    // path tracing loop split into one compute pass per stage, with
+    // queues between the stages and shading sorted by material.
+    enum WfStage {
+        WF_GENERATE, WF_EXTEND, WF_SORT, WF_SCATTER, WF_SHADE, WF_SHADOW, WF_RESOLVE,
+        WF_STAGE_COUNT };
+    bool useWavefront = false;
+    BufferWrap m_wfPathBuff{};
+    BufferWrap m_wfHitBuff{};
+    BufferWrap m_wfFirstHitBuff{};
+    BufferWrap m_wfQueueBuff[2]{};
+    BufferWrap m_wfSortedBuff{};
+    BufferWrap m_wfShadowBuff{};
+    BufferWrap m_wfCounterBuff{};
+    BufferWrap m_wfBinBuff{};
+    uint32_t   m_wfBins = WF_BINS;  // One per material:  a power of two, at least WF_BINS
+    DescriptorWrap m_wfDesc{};
+    VkPipelineLayout m_wfPipelineLayout{};
+    VkPipeline       m_wfPipelines[WF_STAGE_COUNT]{};
+    void createWfBuffers();
+    void createWfDescriptorSet();
+    void createWfPipelines();
+    void wavefront();
+
+    // Per stage GPU times, from a timestamp after each stage, and lane
+    // utilization, from each bounce's queue counters.
+    VkQueryPool m_wfTimestampPool{VK_NULL_HANDLE};
+    std::vector<WfStage> m_wfTimedStages{};  // Stage ending at each timestamp after the first
+    BufferWrap  m_wfStatsBuff{};             // WfCounters after each bounce
+    WfCounters* m_wfStats = nullptr;         // Mapped m_wfStatsBuff
+    int         m_wfBounces = 0;             // Bounces traced in the pending frame
+    double      m_wfReportMs[WF_STAGE_COUNT]{};
+    uint64_t    m_wfReportItems[WF_STAGE_COUNT]{};
+    uint64_t    m_wfReportLanes[WF_STAGE_COUNT]{};
+    void readWavefrontStats();
+    void reportWavefront(int frames);
     
     BufferWrap m_shaderBindingTableBuff;
     VkStridedDeviceAddressRegionKHR m_rgenRegion{};
@@ -247,14 +695,49 @@ public:
     DescriptorWrap m_postDesc{};
     void createPostDescriptor();
 
+    // Auto-exposure and tone mapping:  three compute passes turn the
+    // HDR m_renderTarget into m_displayBuffer for the post pass;  see
+    // vkapp_tonemap.cpp.
+    ImageWrap        m_displayBuffer{};
+    BufferWrap       m_tonemapStatsBuff{};
+    TonemapStats*    m_tonemapStats = nullptr;  // Mapped m_tonemapStatsBuff
+    bool             m_tonemapStatsPending = false;
+    DescriptorWrap   m_tonemapDesc{};
+    VkPipelineLayout m_tonemapPipelineLayout{};
+    VkPipeline       m_histogramPipeline{};
+    VkPipeline       m_exposurePipeline{};
+    VkPipeline       m_tonemapPipeline{};
+    PushConstantTonemap m_pcTonemap{};
+    double           m_tonemapLastTime = 0.0;
+    double           m_tonemapReportStart = 0.0;
+    void createTonemapBuffers();
+    void createTonemapDescriptorSet();
+    void createTonemapPipelines();
+    void tonemap();
+    void readTonemapStats();
+    float tonemapPercentile(float fraction);
+
     DescriptorWrap m_denoiseDesc{};
     void createDenoiseDescriptorSet();
     
     VkPipelineLayout m_denoiseCompPipelineLayout{};
     VkPipeline       m_denoisePipeline{};
+    VkPipeline       m_estimateVariancePipeline{};
     void createDenoiseCompPipeline();
 
-    void CmdCopyImage(ImageWrap& src, ImageWrap& dst);
+    // The denoiser's GPU time and quality (see DenoiseStats), summed
+    // over the report window of reportTraceRate.
+    bool   m_denoiseStatsPending = false;
+    bool   m_denoiseMeasured = false;  // Whether last frame's stats were taken
+    bool   m_lastSvgf = false;         // Mode of last frame's denoise
+    int    m_reportDenoiseFrames = 0;
+    int    m_reportMeasuredFrames = 0;
+    float  m_reportDenoiseMs = 0.0f;
+    double m_reportDenoiseErr = 0.0;
+    void readDenoiseStats();
+    void reportDenoise();
+
+    void CmdCopyImage(ImageWrap& src, ImageWrap& dst, VkExtent2D extent={0, 0});
 
     void imageLayoutBarrier(VkCommandBuffer cmdbuffer,
                             VkImage image,
@@ -265,9 +748,25 @@ public:
                             VkImageAspectFlags aspectMask=VK_IMAGE_ASPECT_COLOR_BIT);
     // Run loop 
     bool useRaytracer = true;
+    bool useSpatialUpscaler = false;  // upscale() in place of taa()
     void prepareFrame();
     void ResetRtAccumulation();
     
+    // GPU timestamps, written into m_timestampPool during a frame and
+    // read back after its fence has signaled.
+    enum TimestampSlot {
+        TS_FRAME_BEGIN, TS_FRAME_END,
+        TS_TRACE_BEGIN, TS_TRACE_END,
+        TS_REPROJECT_END,  // Begins at TS_TRACE_END
+        TS_DENOISE_BEGIN, TS_DENOISE_END,
+        TS_COUNT };
+    VkQueryPool m_timestampPool{VK_NULL_HANDLE};
+    float       m_timestampPeriod = 1.0f;  // Nanoseconds per timestamp tick
+    std::vector<uint64_t> m_timestamps{};   // Last frame's values; 0 if not written
+    void createTimestampQueries();
+    void readTimestamps();
+    float timestampMs(TimestampSlot begin, TimestampSlot end);
+
     glm::mat4 m_priorViewProj{};
     void updateCameraBuffer();
     void rasterize();
@@ -279,7 +778,7 @@ public:
     void postProcess();
     void submitFrame();
     
-    std::string loadFile(const std::string& filename);
+    std::string loadFile(const std::string& filename);  // See vkapp_startup.cpp
     
      void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
     
@@ -292,8 +791,38 @@ public:
                        VkImageLayout layout, 
                        uint32_t mipLevels=1);
     void initTextureSampler(ImageWrap& wrapper);
-
-    ImageWrap readTextureFile(std::string fileName);
+    void initTextureSampler(ImageWrap& wrapper, const SamplerKey& key);
+
+    // Samplers, shared by all images with the same SamplerKey and
+    // counted (see vkapp_samplers.cpp).
+    struct SharedSampler { VkSampler sampler; int refs; };
+    std::map<SamplerKey, SharedSampler> m_samplers{};
+    VkSampler acquireSampler(const SamplerKey& key);
+    void releaseSampler(ImageWrap& wrap);
+    void destroySamplers();
+
+    // A texture file decoded to RGBA8 on a worker thread, for
+    // readTextureFile to upload.
+    struct DecodedTexture {
+        std::string path;                       // Canonical
+        std::shared_ptr<unsigned char> pixels;  // stbi_load's
+        int width = 0, height = 0;
+        std::pair<uint64_t, uint64_t> content{0, 0};  // With -C:  (size, hash)
+        std::vector<unsigned char> bytes;       // With -C:  the file's, to compare
+    };
+    ImageWrap readTextureFile(const DecodedTexture& texture);
+
+    // The texture registry (vkapp_textures.cpp):  one m_objText entry
+    // per canonical path, and with -C, per file content.
+    std::map<std::string, uint32_t> m_textureByPath{};
+    struct TextureContent { uint32_t index; std::string path; };  // path: the first file's
+    std::map<std::pair<uint64_t, uint64_t>, TextureContent> m_textureByContent{};  // (size, hash)
+    int m_textureRefs = 0;
+    int m_textureSharedByPath = 0;
+    int m_textureSharedByContent = 0;
+    VkDeviceSize m_textureBytesSaved = 0;
+    std::vector<uint32_t> loadTextures(const std::vector<std::string>& paths);
+    void reportTextures();
     void generateMipmap(VkImage image, VkFormat imageFormat,
                          int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
     
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////
+// Variance-driven adaptive sampling.  The ray generation shader keeps
+// a per-pixel history of the luminance second moment next to the color
+// history.  After each trace, a compute pass turns the two into a
+// sample mask: converged pixels are skipped, noisy ones get extra
+// samples.  Once no pixel remains active, tracing stops until the
+// camera moves.
+////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define GROUP_SIZE 128
+
+void VkApp::createAdaptiveBuffers()
+{
+    VkFormat format = momentFormat;
+    VkImageUsageFlags flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    VkMemoryPropertyFlags mem = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
+
+    // The luminance second moment pair, swapped by handle with the
+    // color pair (see createRtBuffers).
+    for (int i = 0; i < 2; i++) {
+        initImageWrap(m_rtMomBuffer[i], m_maxRenderSize, format, flags, mem, aspect, layout);
+        NAME(m_rtMomBuffer[i].image, VK_OBJECT_TYPE_IMAGE, "m_rtMomBuffer"); }
+    m_pcRay.momCurr = bindlessStorageImage(m_rtMomBuffer[0]);
+    m_pcRay.momPrev = bindlessStorageImage(m_rtMomBuffer[1]);
+
+    initImageWrap(m_sampleMask, m_maxRenderSize, maskFormat, flags, mem, aspect, layout);
+    NAME(m_sampleMask.image, VK_OBJECT_TYPE_IMAGE, "m_sampleMask");
+
+    // Every pixel starts out active.
+    VkClearColorValue one{{1.0f, 1.0f, 1.0f, 1.0f}};
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    vkCmdClearColorImage(cmdBuf, m_sampleMask.image, VK_IMAGE_LAYOUT_GENERAL, &one, 1, &range);
+    submitTempCmdBuffer(cmdBuf);
+
+    // The active pixel count is written by the GPU and read by the
+    // CPU one frame later, so it lives in (persistently mapped) host memory.
+    initBufferWrap(m_adaptiveStatsBuff, sizeof(uint32_t),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_adaptiveStatsBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_adaptiveStatsBuff");
+    vkMapMemory(m_device, m_adaptiveStatsBuff.memory, 0, sizeof(uint32_t), 0,
+                (void**)&m_adaptiveStats);
+    *m_adaptiveStats = m_renderSize.width*m_renderSize.height;
+}
+
+void VkApp::createVarianceDescriptorSet()
+{
+    m_varianceDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+
+    // The color and second moment histories are read by handle.
+    m_varianceDesc.write(m_device, 0, m_sampleMask.Descriptor());       // The output mask
+    m_varianceDesc.write(m_device, 1, m_adaptiveStatsBuff.buffer);      // Active pixel count
+}
+
+void VkApp::createVariancePipeline()
+{
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantVariance)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    std::vector<VkDescriptorSetLayout> setLayouts = {m_varianceDesc.descSetLayout,
+                                                     m_bindlessDesc.descSetLayout};
+    plCreateInfo.setLayoutCount = (uint32_t)setLayouts.size();
+    plCreateInfo.pSetLayouts = setLayouts.data();
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_variancePipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_variancePipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/variance.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    double start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_variancePipeline);
+    logPipelineTime("variance", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+// Record the mask-building pass.  Called right after the trace, so
+// the mask is ready for the next frame's trace.
+void VkApp::buildSampleMask()
+{
+    PushConstantVariance pcVariance{m_convergenceThreshold, m_minAdaptiveSamples, int(m_renderSize.width),
+                                    m_pcRay.colCurr, m_pcRay.momCurr};
+
+    vkCmdFillBuffer(m_commandBuffer, m_adaptiveStatsBuff.buffer, 0, sizeof(uint32_t), 0);
+
+    // Wait for the ray tracer's color and moment writes, and for the count reset.
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                         | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_variancePipeline);
+    VkDescriptorSet sets[] = {m_varianceDesc.descSet, m_bindlessDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_variancePipelineLayout, 0, 2, sets, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_variancePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantVariance), &pcVariance);
+
+    // This MUST match the shader's GROUP_SIZE
+    vkCmdDispatch(m_commandBuffer, (m_renderSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  m_renderSize.height, 1);
+
+    // The mask is read by the next trace, and the count by the host.
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                         | VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Read the count of active pixels left by the last mask-building
+// pass, and report it.
+void VkApp::readAdaptiveStats()
+{
+    uint32_t pixels = m_renderSize.width*m_renderSize.height;
+    m_activePixels = *m_adaptiveStats;
+    printf("Active pixels: %5.1f%%\n", 100.0f*m_activePixels/pixels);
+}
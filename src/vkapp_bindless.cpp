@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+// The bindless table:  one descriptor set of three arrays, of storage
+// buffers, storage images and textures, which any pass can add to its
+// pipeline layout, and whose shaders index by handle (bindless.glsl).
+// A resource is written into the table once, when it gets its handle;
+// adding a resource, or pointing a handle at another image, is a
+// single descriptor write, not a new set or a rewrite of a pass's set.
+//
+// The arrays are partially bound (unwritten elements are never read)
+// and update-after-bind (written while a bound set may be in flight),
+// and the textures, the last binding, are of variable count.  Their
+// capacities come from the device's update-after-bind limits, queried
+// once here.  The table is made before any image that takes a handle,
+// and the model's textures are written into it once loaded.
+//
+// Every pass reads the model's textures through the table.  The
+// temporal passes' history pairs -- the path tracer's color,
+// normal:depth and moments, the denoiser's ping-pong images, and the
+// TAA history -- are storage image handles, so each swap is an
+// exchange of two handles in a push constant, not an image copy.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+// Upper bounds of the table's arrays, whatever the device allows
+#define BINDLESS_MAX_BUFFERS  1024
+#define BINDLESS_MAX_IMAGES   1024
+#define BINDLESS_MAX_TEXTURES (1<<16)
+
+void VkApp::createBindlessTable()
+{
+    VkPhysicalDeviceVulkan12Properties props12{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES};
+    VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    prop2.pNext = &props12;
+    vkGetPhysicalDeviceProperties2(m_physicalDevice, &prop2);
+
+    uint32_t maxBuffers = std::min({uint32_t(BINDLESS_MAX_BUFFERS),
+            props12.maxDescriptorSetUpdateAfterBindStorageBuffers,
+            props12.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+    uint32_t maxImages = std::min({uint32_t(BINDLESS_MAX_IMAGES),
+            props12.maxDescriptorSetUpdateAfterBindStorageImages,
+            props12.maxPerStageDescriptorUpdateAfterBindStorageImages});
+    // Combined image samplers count as both sampled images and samplers.
+    uint32_t maxTextures = std::min({uint32_t(BINDLESS_MAX_TEXTURES),
+            props12.maxDescriptorSetUpdateAfterBindSampledImages,
+            props12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            props12.maxDescriptorSetUpdateAfterBindSamplers,
+            props12.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+    // Binding numbers MUST match the BINDLESS_* defines in shared_structs.h
+    m_bindlessDesc.setBindings(m_device, {
+            {BINDLESS_BUFFERS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxBuffers, VK_SHADER_STAGE_ALL},
+            {BINDLESS_IMAGES, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxImages, VK_SHADER_STAGE_ALL},
+            {BINDLESS_TEXTURES, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxTextures,
+                VK_SHADER_STAGE_ALL}
+        }, true);
+    NAME(m_bindlessDesc.descSet, VK_OBJECT_TYPE_DESCRIPTOR_SET, "m_bindlessDesc");
+}
+
+// Write the model's textures into the table, once loaded.
+void VkApp::createBindlessTextures()
+{
+    uint32_t maxTextures = m_bindlessDesc.bindingTable[BINDLESS_TEXTURES].descriptorCount;
+    if (m_objText.size() > maxTextures)
+        throw std::runtime_error("The model has more textures than the bindless table holds!");
+
+    // The textures' handles are their indices in m_objText, so that
+    // ObjDesc::txtOffset + Material::textureId remains one.
+    for (const ImageWrap& texture : m_objText)
+        bindlessTexture(texture);
+
+    printf("Bindless table: %d of %d textures, %d of %d storage images, %d of %d buffers.\n",
+           m_bindlessCount[BINDLESS_TEXTURES], maxTextures,
+           m_bindlessCount[BINDLESS_IMAGES], m_bindlessDesc.bindingTable[BINDLESS_IMAGES].descriptorCount,
+           m_bindlessCount[BINDLESS_BUFFERS], m_bindlessDesc.bindingTable[BINDLESS_BUFFERS].descriptorCount);
+}
+
+// Each of these writes the resource at the next handle of its array,
+// and returns the handle.
+uint32_t VkApp::bindlessBuffer(const VkBuffer& buffer)
+{
+    uint32_t handle = m_bindlessCount[BINDLESS_BUFFERS]++;
+    if (handle >= m_bindlessDesc.bindingTable[BINDLESS_BUFFERS].descriptorCount)
+        throw std::runtime_error("The bindless table is out of buffer handles!");
+    m_bindlessDesc.write(m_device, BINDLESS_BUFFERS, handle, buffer);
+    return handle;
+}
+
+uint32_t VkApp::bindlessStorageImage(const ImageWrap& image)
+{
+    uint32_t handle = m_bindlessCount[BINDLESS_IMAGES]++;
+    if (handle >= m_bindlessDesc.bindingTable[BINDLESS_IMAGES].descriptorCount)
+        throw std::runtime_error("The bindless table is out of storage image handles!");
+    bindlessStorageImage(handle, image);
+    return handle;
+}
+
+uint32_t VkApp::bindlessTexture(const ImageWrap& texture)
+{
+    uint32_t handle = m_bindlessCount[BINDLESS_TEXTURES]++;
+    if (handle >= m_bindlessDesc.bindingTable[BINDLESS_TEXTURES].descriptorCount)
+        throw std::runtime_error("The bindless table is out of texture handles!");
+    m_bindlessDesc.write(m_device, BINDLESS_TEXTURES, handle,
+                         texture.Descriptor(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+    return handle;
+}
+
+// Point an existing storage image handle at another image (in the
+// GENERAL layout), e.g. one recreated at a new size.  The table is
+// update-after-bind, so this may happen while it is bound, though not
+// while a submitted command buffer may still read the handle.
+void VkApp::bindlessStorageImage(uint32_t handle, const ImageWrap& image)
+{
+    m_bindlessDesc.write(m_device, BINDLESS_IMAGES, handle,
+                         image.Descriptor(VK_IMAGE_LAYOUT_GENERAL));
+}
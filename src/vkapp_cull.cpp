@@ -0,0 +1,444 @@
+//////////////////////////////////////////////////////////////////////
+// GPU-driven raster.  createCullBuffers lists every mesh (see
+// MeshRange) of every instance as a CullInstance, once, in
+// m_cullMeshes;  and likewise every meshlet (see Meshlet) in
+// m_cullMeshlets.  Each frame, cull.comp tests each of one list
+// against the view frustum and appends the survivors'
+// VkDrawIndirectCommand's to the list's drawBuff, counting them in its
+// countBuff.  drawCulled then records a single vkCmdDrawIndirectCount
+// per pass, with scanlineIndirect.vert, which finds each draw's object
+// and transform from its firstInstance, and fetches the object's
+// indices and vertices through its ObjDesc addresses, so no vertex or
+// index buffer is bound.  The CPU records the same few commands
+// however many instances and objects there are.
+//
+// Meshlets (-M, toggled with the M key) are also tested against
+// their normal cones, so are drawn with back-face culling.  With mesh
+// shaders, meshlet.task runs cull.comp's tests (cull.glsl) in place
+// of cull.comp, and meshlet.mesh draws the survivors, all in one
+// vkCmdDrawMeshTasksEXT.  -F forces the cull.comp fallback.
+//
+// Two-phase occlusion culling (on unless -O, toggled with the O key):
+// the early pass draws only what was visible last frame, as kept in
+// the list's visibleBuff.  buildHiz reduces its depth into a pyramid
+// (m_hizImage, hiz.comp), against which the late pass tests every
+// instance, recording what is visible for the next frame, and draws
+// those that are newly visible into m_scLateRenderPass.
+//
+// Selected with -G and toggled with the G key, against the original
+// loop of one vkCmdDrawIndexed per instance.  Either way, rasterize
+// reports its CPU recording time, and the GPU-driven mode its drawn
+// and culled counts, once a second.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define GROUP_SIZE 64     // cull.comp's
+#define HIZ_GROUP_SIZE 8  // hiz.comp's
+
+// One CullInstance per mesh, or per meshlet, of each instance, with
+// its share of the draws.
+void VkApp::createCullList(CullList& list, const char* name, bool meshlets)
+{
+    list.name = name;
+
+    // Built once, like the TLAS;  an instance that moved would need
+    // its entries updated too.  Meshes have no normal cone.
+    std::vector<CullInstance> instances;
+    for (const ObjInst& inst : m_objInst) {
+        if (meshlets)
+            for (const Meshlet& m : m_objData[inst.objIndex].meshlets)
+                instances.push_back({inst.transform, m.sphere, m.cone, inst.objIndex,
+                                     m.firstIndex, m.indexCount, m.vertexOffset, m.vertexCount});
+        else
+            for (const MeshRange& mesh : m_objData[inst.objIndex].meshes)
+                instances.push_back({inst.transform, mesh.sphere, glm::vec4(0, 0, 1, 1), inst.objIndex,
+                                     mesh.firstIndex, mesh.indexCount, 0, 0}); }
+    list.instanceCount = static_cast<uint32_t>(instances.size());
+    if (list.instanceCount == 0)
+        throw std::runtime_error("The model has no meshes to draw!");
+
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    initBufferWrapFromData(list.instanceBuff, cmdBuf, instances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    submitTempCmdBuffer(cmdBuf);
+    NAME(list.instanceBuff.buffer, VK_OBJECT_TYPE_BUFFER, "CullList.instanceBuff");
+
+    // Halves for the early and late passes
+    initBufferWrap(list.drawBuff, 2 * list.instanceCount * sizeof(VkDrawIndirectCommand),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    NAME(list.drawBuff.buffer, VK_OBJECT_TYPE_BUFFER, "CullList.drawBuff");
+
+    initBufferWrap(list.countBuff, 2 * sizeof(uint32_t),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                   | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    NAME(list.countBuff.buffer, VK_OBJECT_TYPE_BUFFER, "CullList.countBuff");
+
+    // Nothing was visible before the first frame:  its early pass
+    // draws nothing, and its late pass everything in view.
+    initBufferWrap(list.visibleBuff, list.instanceCount * sizeof(uint32_t),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    NAME(list.visibleBuff.buffer, VK_OBJECT_TYPE_BUFFER, "CullList.visibleBuff");
+    cmdBuf = createTempCmdBuffer();
+    vkCmdFillBuffer(cmdBuf, list.visibleBuff.buffer, 0, VK_WHOLE_SIZE, 0);
+    submitTempCmdBuffer(cmdBuf);
+}
+
+void VkApp::createCullBuffers()
+{
+    createCullList(m_cullMeshes, "meshes", false);
+    createCullList(m_cullMeshlets, "meshlets", true);
+    if (m_meshShader)
+        m_cullStages |= VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT;
+
+    initBufferWrap(m_cullStatsBuff, sizeof(CullStats),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_cullStatsBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_cullStatsBuff");
+    vkMapMemory(m_device, m_cullStatsBuff.memory, 0, sizeof(CullStats), 0, (void**)&m_cullStats);
+
+    // The depth pyramid, at the window size and below, each level
+    // half the last, rounded down as mip levels are.  Its imageView has every level, for
+    // the culling pass to fetch from;  hiz.comp writes each level
+    // through its own view.
+    m_hizLevels = 1;
+    while ((m_windowSize.width >> m_hizLevels) > 0 || (m_windowSize.height >> m_hizLevels) > 0)
+        m_hizLevels++;
+    m_hizLevels = std::min(m_hizLevels, HIZ_MAX_LEVELS);
+    initImageWrap(m_hizImage, m_windowSize, VK_FORMAT_R32_SFLOAT,
+                  VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL, m_hizLevels);
+    NAME(m_hizImage.image, VK_OBJECT_TYPE_IMAGE, "m_hizImage");
+
+    VkImageViewCreateInfo viewInfo{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+    viewInfo.image = m_hizImage.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, uint32_t(m_hizLevels), 0, 1};
+    vkDestroyImageView(m_device, m_hizImage.imageView, nullptr);
+    vkCreateImageView(m_device, &viewInfo, nullptr, &m_hizImage.imageView);
+    m_hizLevelViews.resize(m_hizLevels);
+    for (int level = 0;  level < m_hizLevels;  level++) {
+        viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, uint32_t(level), 1, 0, 1};
+        vkCreateImageView(m_device, &viewInfo, nullptr, &m_hizLevelViews[level]); }
+
+    // Exact texel fetches, of the pyramid and of the depth buffer
+    SamplerKey key;
+    key.filter = VK_FILTER_NEAREST;
+    key.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    key.addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    initTextureSampler(m_hizImage, key);
+
+    printf("GPU-driven raster: %u meshes, %u meshlets in %zu instances%s%s%s\n",
+           m_cullMeshes.instanceCount, m_cullMeshlets.instanceCount, m_objInst.size(),
+           m_drawIndirectCount ? "" : " (unsupported:  no drawIndirectCount)",
+           m_hizSupported ? "" : " (no occlusion culling:  the depth format cannot be sampled)",
+           m_meshShader ? "" : " (no mesh shaders:  meshlets through cull.comp)");
+}
+
+void VkApp::createCullDescriptorSet()
+{
+    // The tests' bindings are also the mesh shaders';  binding 0 is
+    // also the indirect draws' vertex shader's.  Set 1 of both.
+    VkShaderStageFlags meshStages = m_meshShader
+        ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT : 0;
+    for (CullList* list : {&m_cullMeshes, &m_cullMeshlets}) {
+        list->desc.setBindings(m_device, {
+                {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                    VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT | meshStages},
+                {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+                {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+                {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | meshStages},
+                {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | meshStages},
+                {5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | meshStages},
+                {6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT | meshStages}
+            });
+
+        list->desc.write(m_device, 0, list->instanceBuff.buffer);
+        list->desc.write(m_device, 1, list->drawBuff.buffer);
+        list->desc.write(m_device, 2, list->countBuff.buffer);
+        list->desc.write(m_device, 3, m_cullStatsBuff.buffer);
+        list->desc.write(m_device, 4, list->visibleBuff.buffer);
+        list->desc.write(m_device, 5, m_matrixBuff.buffer);
+        list->desc.write(m_device, 6, m_hizImage.Descriptor()); }  // The whole pyramid
+
+    // The depth pyramid's:  the depth buffer, and each level.  Levels
+    // past the last are never used, but the array must be filled.
+    m_hizDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, HIZ_MAX_LEVELS, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+    if (m_hizSupported)
+        m_hizDesc.write(m_device, 0, VkDescriptorImageInfo{m_hizImage.sampler, m_depthImage.imageView,
+                                                           VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL});
+
+    std::vector<VkDescriptorImageInfo> levels(HIZ_MAX_LEVELS);
+    for (int level = 0;  level < HIZ_MAX_LEVELS;  level++)
+        levels[level] = {VK_NULL_HANDLE, m_hizLevelViews[std::min(level, m_hizLevels - 1)],
+                         VK_IMAGE_LAYOUT_GENERAL};
+    VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    writeSet.dstSet          = m_hizDesc.descSet;
+    writeSet.dstBinding      = 1;
+    writeSet.descriptorCount = HIZ_MAX_LEVELS;
+    writeSet.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writeSet.pImageInfo      = levels.data();
+    vkUpdateDescriptorSets(m_device, 1, &writeSet, 0, nullptr);
+}
+
+void VkApp::createCullPipeline()
+{
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantCull)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.setLayoutCount = 1;
+    plCreateInfo.pSetLayouts = &m_cullMeshes.desc.descSetLayout;  // Alike for both lists
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_cullPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_cullPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/cull.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    double start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_cullPipeline);
+    logPipelineTime("cull", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    pc_info.size = sizeof(PushConstantHiz);
+    plCreateInfo.pSetLayouts = &m_hizDesc.descSetLayout;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_hizPipelineLayout);
+
+    cpCreateInfo.layout = m_hizPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/hiz.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_hizPipeline);
+    logPipelineTime("hiz", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+// The culling tests' parameters for a pass of list.
+PushConstantCull VkApp::cullParams(const CullList& list, uint32_t phase)
+{
+    PushConstantCull pcCull{};
+    pcCull.instanceCount = list.instanceCount;
+    pcCull.phase = phase;
+    pcCull.hizLevels = m_hizLevels;
+    pcCull.width = m_windowSize.width;
+    pcCull.height = m_windowSize.height;
+    return pcCull;
+}
+
+// Clear list's counts (both passes') and the stats for a frame's
+// culling.  Outside the render pass.
+void VkApp::beginCull(CullList& list)
+{
+    // After last frame's culling and draws
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT
+        | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, m_cullStages | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | m_cullStages, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdFillBuffer(m_commandBuffer, list.countBuff.buffer, 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(m_commandBuffer, m_cullStatsBuff.buffer, 0, sizeof(CullStats), 0);
+
+    // Wait for the clears
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, m_cullStages, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Record a culling pass of list:  CULL_FRUSTUM alone, or CULL_EARLY
+// then, after buildHiz, CULL_LATE.  Outside the render pass.
+void VkApp::cull(CullList& list, uint32_t phase)
+{
+    PushConstantCull pcCull = cullParams(list, phase);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_cullPipelineLayout, 0, 1, &list.desc.descSet, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantCull), &pcCull);
+    // This MUST match the shader's GROUP_SIZE
+    vkCmdDispatch(m_commandBuffer, (list.instanceCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+
+    // The draws and counts are read by the indirect draws;  the counts
+    // and visibility by the late pass.
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+        | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Make the frame's stats visible to the host, after its last pass.
+void VkApp::endCull()
+{
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, m_cullStages, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+    m_cullStatsPending = true;
+}
+
+// Record the depth pyramid's levels from the early pass's depth.
+void VkApp::buildHiz()
+{
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_hizPipelineLayout, 0, 1, &m_hizDesc.descSet, 0, nullptr);
+
+    // The early pass's culling writes (meshlet.task's, in the render
+    // pass) before the late pass's
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, m_cullStages, m_cullStages, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Each level reads the last, and the late pass the whole pyramid.
+    // (m_scRenderPass's dependency makes the depth visible to the
+    // first.)
+
+    PushConstantHiz pcHiz{};
+    for (int level = 0;  level < m_hizLevels;  level++) {
+        pcHiz.level = level;
+        pcHiz.srcWidth = level == 0 ? m_windowSize.width : pcHiz.width;
+        pcHiz.srcHeight = level == 0 ? m_windowSize.height : pcHiz.height;
+        pcHiz.width = std::max(1, int(m_windowSize.width >> level));  // The mip's size
+        pcHiz.height = std::max(1, int(m_windowSize.height >> level));
+        vkCmdPushConstants(m_commandBuffer, m_hizPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(PushConstantHiz), &pcHiz);
+        // This MUST match the shader's GROUP_SIZE
+        vkCmdDispatch(m_commandBuffer, (pcHiz.width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+                      (pcHiz.height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, m_cullStages, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr); }
+}
+
+// Record the culled draws of a pass of list:  CULL_LATE's, or the
+// others'.  With meshShader, meshlet.task culls them here.  Inside the
+// scanline render pass.
+void VkApp::drawCulled(CullList& list, uint32_t phase, bool meshShader)
+{
+    VkDescriptorSet sets[] = {m_scDesc.descSet, m_bindlessDesc.descSet, list.desc.descSet};
+
+    if (meshShader) {
+        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_meshletPipeline);
+        vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                m_meshletPipelineLayout, 0, 3, sets, 0, nullptr);
+        PushConstantMeshlet pcMeshlet{scLightPos, scLightInt, scLightAmb, cullParams(list, phase)};
+        vkCmdPushConstants(m_commandBuffer, m_meshletPipelineLayout,
+                           VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT
+                           | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(PushConstantMeshlet), &pcMeshlet);
+        // This MUST match the task shader's MESHLET_TASK_SIZE
+        vkCmdDrawMeshTasksEXT(m_commandBuffer,
+                              (list.instanceCount + MESHLET_TASK_SIZE - 1) / MESHLET_TASK_SIZE, 1, 1);
+        return; }
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_scIndirectPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_scIndirectPipelineLayout, 0, 3, sets, 0, nullptr);
+    // Meshlets facing away are culled already;  the rest of their
+    // back faces are, with them, culled here.
+    vkCmdSetCullMode(m_commandBuffer, &list == &m_cullMeshlets ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE);
+
+    // Only the lights are used;  each draw's instance is in its CullInstance.
+    PushConstantRaster pcRaster{scLightPos, scLightInt, scLightAmb, glm::mat4(1.0f), 0};
+    vkCmdPushConstants(m_commandBuffer, m_scIndirectPipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                       sizeof(PushConstantRaster), &pcRaster);
+
+    // The pass's half of the draws, and its count:  every object's
+    // draws at once, as the vertex shader finds each one's buffers.
+    const uint32_t stride = sizeof(VkDrawIndirectCommand);
+    uint32_t part = phase == CULL_LATE ? 1 : 0;
+    vkCmdDrawIndirectCount(m_commandBuffer,
+                           list.drawBuff.buffer, part * list.instanceCount * stride,
+                           list.countBuff.buffer, part * sizeof(uint32_t),
+                           list.instanceCount, stride);
+}
+
+// Fold last frame's culling counts into the report window.
+void VkApp::readCullStats()
+{
+    if (!m_cullStatsPending)
+        return;
+    m_rasterReportDrawn += m_cullStats->drawn;
+    m_rasterReportDrawnLate += m_cullStats->drawnLate;
+    m_rasterReportCulled += m_cullStats->frustumCulled;
+    m_rasterReportConeCulled += m_cullStats->coneCulled;
+    m_rasterReportOccluded += m_cullStats->occlusionCulled;
+    m_cullStatsPending = false;
+}
+
+// Add a frame's CPU recording time to the report window, and print
+// the window once a second has passed.  list is the GPU-driven mode's.
+void VkApp::reportRaster(const std::string& mode, const CullList* list, double cpuMs, double workerMs)
+{
+    if (mode != m_rasterReportMode) {  // Start a new window for the new mode
+        m_rasterReportMode = mode;
+        m_rasterReportFrames = 0;
+        m_rasterReportCpuMs = 0.0;
+        m_rasterReportWorkerMs = 0.0;
+        m_rasterReportDrawn = 0;
+        m_rasterReportDrawnLate = 0;
+        m_rasterReportCulled = 0;
+        m_rasterReportConeCulled = 0;
+        m_rasterReportOccluded = 0;
+        m_rasterReportStart = 0.0; }
+
+    m_rasterReportCpuMs += cpuMs;
+    m_rasterReportWorkerMs += workerMs;
+    m_rasterReportFrames++;
+
+    double now = glfwGetTime();
+    if (m_rasterReportStart == 0.0)
+        m_rasterReportStart = now;
+    double elapsed = now - m_rasterReportStart;
+    if (elapsed < 1.0)
+        return;
+
+    double frames = m_rasterReportFrames;
+    printf("Raster (%s): %.1f frames/s, %.3f ms CPU recording",
+           mode.c_str(), frames / elapsed, m_rasterReportCpuMs / frames);
+    if (m_rasterReportWorkerMs > 0.0)
+        printf(" (%.3f ms on the recording threads)", m_rasterReportWorkerMs / frames);
+    if (list)
+        printf(", %.0f of %u %s drawn (%.0f late), culled: %.0f frustum, %.0f back-facing, %.0f occluded",
+               m_rasterReportDrawn / frames, list->instanceCount, list->name,
+               m_rasterReportDrawnLate / frames, m_rasterReportCulled / frames,
+               m_rasterReportConeCulled / frames, m_rasterReportOccluded / frames);
+    else
+        printf(", %zu instances drawn", m_objInst.size());
+    printf("\n");
+
+    m_rasterReportFrames = 0;
+    m_rasterReportCpuMs = 0.0;
+    m_rasterReportWorkerMs = 0.0;
+    m_rasterReportDrawn = 0;
+    m_rasterReportDrawnLate = 0;
+    m_rasterReportCulled = 0;
+    m_rasterReportConeCulled = 0;
+    m_rasterReportOccluded = 0;
+    m_rasterReportStart = now;
+}
@@ -0,0 +1,279 @@
+//////////////////////////////////////////////////////////////////////
+// Deferred raster (-I, toggled with the I key).  scanline.frag fetches
+// the object, material index and material (and maybe a texel) for
+// every fragment drawn, so overdraw multiplies the shading cost.  The
+// deferred raster instead draws the instances with deferredId.frag,
+// which writes only the packed object and triangle index of each
+// pixel into m_idBuffer, against the depth.  deferred.comp then
+// shades each pixel of m_renderTarget exactly once:  it reconstructs
+// the triangle's attributes through the ObjDesc device addresses, at
+// the barycentric coordinates of the pixel's eye ray, and lights them
+// as scanline.frag would.  The shading cost follows the window size,
+// not the scene's depth complexity.
+//
+// It replaces the per-instance draw loop of rasterize;  the GPU-driven
+// raster (-G) keeps its forward shading.
+////////////////////////////////////////////////////////////////////////
+
+#include <array>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define GROUP_SIZE 8
+
+void VkApp::createDeferredBuffers()
+{
+    VkImageUsageFlags flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    initImageWrap(m_idBuffer, m_windowSize, idFormat, flags,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL);
+    NAME(m_idBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_idBuffer");
+
+    // The ID pass draws against m_depthImage, as the forward raster
+    // does.  The shading pass waits for its IDs, and the next frame's
+    // ID pass for the shading pass to be done with them.
+    VkAttachmentDescription idAttachment{};
+    idAttachment.format = idFormat;
+    idAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    idAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    idAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    idAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    idAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    idAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+    idAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentDescription depthAttachment = idAttachment;
+    depthAttachment.format = VK_FORMAT_X8_D24_UNORM_PACK32;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference idAttachmentRef{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkAttachmentReference depthAttachmentRef{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &idAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    VkSubpassDependency before{};
+    before.srcSubpass = VK_SUBPASS_EXTERNAL;
+    before.dstSubpass = 0;
+    before.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    before.srcAccessMask = 0;
+    before.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    before.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkSubpassDependency after{};
+    after.srcSubpass = 0;
+    after.dstSubpass = VK_SUBPASS_EXTERNAL;
+    after.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    after.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    after.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    after.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    std::array<VkSubpassDependency, 2> dependencies = {before, after};
+    std::array<VkAttachmentDescription, 2> attachmentsDsc = {idAttachment, depthAttachment};
+    VkRenderPassCreateInfo renderPassInfo{VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentsDsc.size());
+    renderPassInfo.pAttachments = attachmentsDsc.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+    vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_idRenderPass);
+
+    std::vector<VkImageView> attachments = {m_idBuffer.imageView, m_depthImage.imageView};
+    VkFramebufferCreateInfo info{VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+    info.renderPass      = m_idRenderPass;
+    info.attachmentCount = attachments.size();
+    info.pAttachments    = attachments.data();
+    info.width           = m_windowSize.width;
+    info.height          = m_windowSize.height;
+    info.layers          = 1;
+    vkCreateFramebuffer(m_device, &info, nullptr, &m_idFramebuffer);
+}
+
+void VkApp::createDeferredDescriptorSet()
+{
+    m_deferredDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+
+    m_deferredDesc.write(m_device, 0, m_idBuffer.Descriptor());      // The ID pass's output
+    m_deferredDesc.write(m_device, 1, m_renderTarget.Descriptor());  // The shaded image, for tonemap()
+}
+
+// The ID pass's pipeline is createScPipeline's, but for
+// deferredId.frag;  the shading pass's reads m_scDesc as set 1 for the
+// camera, objects and instance transforms.
+void VkApp::createDeferredPipelines()
+{
+    VkPushConstantRange pushConstantRange = {
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantRaster)};
+
+    VkPipelineLayoutCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    createInfo.setLayoutCount         = 1;
+    createInfo.pSetLayouts            = &m_scDesc.descSetLayout;
+    createInfo.pushConstantRangeCount = 1;
+    createInfo.pPushConstantRanges    = &pushConstantRange;
+    if (vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_idPipelineLayout) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create pipeline layout!");
+    }
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {
+        createShaderStageInfo(loadFile("spv/scanline.vert.spv"), VK_SHADER_STAGE_VERTEX_BIT),
+        createShaderStageInfo(loadFile("spv/deferredId.frag.spv"), VK_SHADER_STAGE_FRAGMENT_BIT)};
+
+    VkVertexInputBindingDescription bindingDescription
+        {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX};
+
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions {
+        {0, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, pos))},
+        {1, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, nrm))},
+        {2, 0, VK_FORMAT_R32G32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, texCoord))}};
+
+    VkPipelineVertexInputStateCreateInfo
+        vertexInputInfo{VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+    VkPipelineInputAssemblyStateCreateInfo
+        inputAssembly{VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkViewport viewport{0.0f, 0.0f, float(m_windowSize.width), float(m_windowSize.height), 0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, m_windowSize};
+    VkPipelineViewportStateCreateInfo
+        viewportState{VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+
+    VkPipelineRasterizationStateCreateInfo
+        rasterizer{VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo
+        multisampling{VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo
+        depthStencil{VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo
+        colorBlending{VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = m_idPipelineLayout;
+    pipelineInfo.renderPass = m_idRenderPass;
+    pipelineInfo.subpass = 0;
+
+    double start = glfwGetTime();
+    if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_idPipeline) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create graphics pipeline!");
+    }
+    logPipelineTime("deferred ID", start);
+    vkDestroyShaderModule(m_device, shaderStages[0].module, nullptr);
+    vkDestroyShaderModule(m_device, shaderStages[1].module, nullptr);
+
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDeferred)};
+    std::vector<VkDescriptorSetLayout> descSetLayouts =
+        {m_deferredDesc.descSetLayout, m_scDesc.descSetLayout, m_bindlessDesc.descSetLayout};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.setLayoutCount = static_cast<uint32_t>(descSetLayouts.size());
+    plCreateInfo.pSetLayouts = descSetLayouts.data();
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_deferredPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_deferredPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/deferred.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_deferredPipeline);
+    logPipelineTime("deferred", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+// Record the ID pass, one draw per instance as in rasterize, then the
+// shading pass over the window.
+void VkApp::rasterizeDeferred()
+{
+    std::array<VkClearValue, 2> clearValues{};
+    clearValues[0].color.uint32[0] = DEFERRED_NO_HIT;
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo beginInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+    beginInfo.clearValueCount = 2;
+    beginInfo.pClearValues    = clearValues.data();
+    beginInfo.renderPass      = m_idRenderPass;
+    beginInfo.framebuffer     = m_idFramebuffer;
+    beginInfo.renderArea      = {{0, 0}, m_windowSize};
+    vkCmdBeginRenderPass(m_commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_idPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_idPipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
+
+    VkDeviceSize offset{0};
+    for (const ObjInst& inst : m_objInst) {
+        auto& object = m_objData[inst.objIndex];
+        PushConstantRaster pcRaster{scLightPos, scLightInt, scLightAmb, inst.transform, inst.objIndex};
+        vkCmdPushConstants(m_commandBuffer, m_idPipelineLayout,
+                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(PushConstantRaster), &pcRaster);
+        vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, &object.vertexBuffer.buffer, &offset);
+        vkCmdBindIndexBuffer(m_commandBuffer, object.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexed(m_commandBuffer, object.nbIndices, 1, 0, 0, 0); }
+
+    vkCmdEndRenderPass(m_commandBuffer);
+
+    PushConstantDeferred pc{scLightPos, scLightInt, scLightAmb,
+                            int(m_windowSize.width), int(m_windowSize.height)};
+    std::vector<VkDescriptorSet> descSets{m_deferredDesc.descSet, m_scDesc.descSet,
+                                          m_bindlessDesc.descSet};
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_deferredPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_deferredPipelineLayout, 0,
+                            descSets.size(), descSets.data(), 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_deferredPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantDeferred), &pc);
+    // This MUST match the shader's GROUP_SIZE
+    vkCmdDispatch(m_commandBuffer, (m_windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  (m_windowSize.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+}
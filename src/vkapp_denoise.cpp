@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <algorithm>
 #include <math.h>
 
 #include "vkapp.h"
@@ -20,13 +21,33 @@ using namespace glm;
 
 void VkApp::createDenoiseBuffer()
 {
-  VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+  VkFormat format = colorFormat;
   VkImageUsageFlags flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
   VkMemoryPropertyFlags mem = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
   VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
   VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
 
-  initImageWrap(m_denoiseBuffer, m_windowSize, format, flags, mem, aspect, layout);
+  // The A-Trous passes alternate between the pair, by handle
+  for (int i = 0; i < 2; i++) {
+    initImageWrap(m_denoiseBuffer[i], m_maxRenderSize, format, flags, mem, aspect, layout);
+    NAME(m_denoiseBuffer[i].image, VK_OBJECT_TYPE_IMAGE, "m_denoiseBuffer");
+    m_denoiseHandles[i] = bindlessStorageImage(m_denoiseBuffer[i]); }
+  initImageWrap(m_denoisePrevBuffer, m_maxRenderSize, format, flags, mem, aspect, layout);
+  NAME(m_denoisePrevBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_denoisePrevBuffer");
+
+  // Luminance variance for the variance-guided mode, ping-ponged
+  // through the A-Trous passes like the color
+  flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+  for (int i = 0; i < 2; i++) {
+    initImageWrap(m_denoiseVarBuffer[i], m_maxRenderSize, varianceFormat, flags, mem, aspect, layout);
+    NAME(m_denoiseVarBuffer[i].image, VK_OBJECT_TYPE_IMAGE, "m_denoiseVarBuffer");
+    m_denoiseVarHandles[i] = bindlessStorageImage(m_denoiseVarBuffer[i]); }
+
+  initBufferWrap(m_denoiseStatsBuff, sizeof(DenoiseStats),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  NAME(m_denoiseStatsBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_denoiseStatsBuff");
+  vkMapMemory(m_device, m_denoiseStatsBuff.memory, 0, sizeof(DenoiseStats), 0, (void**)&m_denoiseStats);
 }
 
 void VkApp::createDenoiseDescriptorSet()
@@ -34,14 +55,17 @@ void VkApp::createDenoiseDescriptorSet()
   m_denoiseDesc.setBindings(m_device, {
           {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
           {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
-          {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
-          {3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+          {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}
     });
 
-  m_denoiseDesc.write(m_device, 0, m_renderTarget.Descriptor());   // The input image
-  m_denoiseDesc.write(m_device, 1, m_denoiseBuffer.Descriptor());   // The output image
-  m_denoiseDesc.write(m_device, 2, m_rtKdCurrBuffer.Descriptor());  // The color buffer
-  m_denoiseDesc.write(m_device, 3, m_rtNdCurrBuffer.Descriptor());  // The normal:depth buffer
+  // The color, normal:depth, moments and variance, which change roles
+  // from pass to pass or frame to frame, are read by the handles in
+  // m_pcDenoise.
+  DescriptorBatch batch;
+  batch.write(m_denoiseDesc, 0, m_rtKdBuffer.Descriptor());         // The color buffer
+  batch.write(m_denoiseDesc, 1, m_denoisePrevBuffer.Descriptor());  // Last frame's output
+  batch.write(m_denoiseDesc, 2, m_denoiseStatsBuff.buffer);
+  batch.flush(m_device);
 }
 
 void VkApp::createDenoiseCompPipeline()
@@ -49,8 +73,10 @@ void VkApp::createDenoiseCompPipeline()
   // pushing time
   VkPushConstantRange pc_info = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise) };
   VkPipelineLayoutCreateInfo plCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-  plCreateInfo.setLayoutCount = 1;
-  plCreateInfo.pSetLayouts = &m_denoiseDesc.descSetLayout;
+  std::vector<VkDescriptorSetLayout> setLayouts = { m_denoiseDesc.descSetLayout,
+                                                    m_bindlessDesc.descSetLayout };
+  plCreateInfo.setLayoutCount = (uint32_t)setLayouts.size();
+  plCreateInfo.pSetLayouts = setLayouts.data();
   plCreateInfo.pushConstantRangeCount = 1;
   plCreateInfo.pPushConstantRanges = &pc_info;
   vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_denoiseCompPipelineLayout);
@@ -60,7 +86,17 @@ void VkApp::createDenoiseCompPipeline()
 
   cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/denoise.comp.spv"),
     VK_SHADER_STAGE_COMPUTE_BIT);
-  vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_denoisePipeline);
+  double start = glfwGetTime();
+  vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_denoisePipeline);
+  logPipelineTime("denoise", start);
+  vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+  // The variance-guided mode's variance estimate;  same layout
+  cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/estimateVariance.comp.spv"),
+    VK_SHADER_STAGE_COMPUTE_BIT);
+  start = glfwGetTime();
+  vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_estimateVariancePipeline);
+  logPipelineTime("estimateVariance", start);
   vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
 
 }
@@ -69,33 +105,83 @@ void VkApp::denoise()
 {
   m_pcDenoise.normFactor = 0.003;
   m_pcDenoise.depthFactor = 0.007;
-
-  // Wait for RT to finish
-  VkImageSubresourceRange range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-  VkImageMemoryBarrier    imgMemBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-  imgMemBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-  imgMemBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-  imgMemBarrier.image = m_renderTarget.image;
-  imgMemBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-  imgMemBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-  imgMemBarrier.subresourceRange = range;
-
-  vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+  m_pcDenoise.svgf = app->useSvgf;
+  m_pcDenoise.lumFactor = 4.0;
+  m_pcDenoise.minHistory = 4;
+  m_pcDenoise.width = m_renderSize.width;
+  m_pcDenoise.height = m_renderSize.height;
+  m_pcDenoise.ndImage = m_pcRay.ndCurr;
+  m_pcDenoise.momImage = m_pcRay.momCurr;
+
+  // The quality measure compares against last frame's output, so is
+  // only taken while the camera holds still and the mode is unchanged.
+  bool measure = !m_pcRay.clear && app->useSvgf == m_lastSvgf;
+  if (app->useSvgf != m_lastSvgf) {
+    reportDenoise();  // Close the old mode's report
+    m_denoiseStatsPending = false; }
+  m_lastSvgf = app->useSvgf;
+  m_pcDenoise.measure = measure;
+
+  // Written once the trace has finished, so the time is the denoiser's own
+  vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      m_timestampPool, TS_DENOISE_BEGIN);
+  if (measure)
+    vkCmdFillBuffer(m_commandBuffer, m_denoiseStatsBuff.buffer, 0, sizeof(DenoiseStats), 0);
+
+  // Wait for RT to finish (and the stats to clear)
+  VkMemoryBarrier memBarrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+  memBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  memBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(m_commandBuffer,
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-    VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &imgMemBarrier);
+    VK_DEPENDENCY_DEVICE_GROUP_BIT, 1, &memBarrier, 0, nullptr, 0, nullptr);
+
+  // Select the compute shader, and its descriptor sets
+  VkDescriptorSet sets[] = { m_denoiseDesc.descSet, m_bindlessDesc.descSet };
+  vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+    m_denoiseCompPipelineLayout, 0, 2, sets, 0, nullptr);
+
+  // Between passes, each reads what the last wrote
+  memBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+  // The first pass reads the path tracer's history, and each pass
+  // after the output of the one before:  the handles swap instead of
+  // the images being copied.
+  m_pcDenoise.inImage = m_pcRay.colCurr;
+  m_pcDenoise.inVariance = m_denoiseVarHandles[0];
+  m_denoiseOutput = m_pcRay.colCurr;
+
+  // Variance-guided mode:  estimate the variance the first pass's
+  // luminance weight is scaled by
+  if (m_pcDenoise.svgf) {
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_estimateVariancePipeline);
+    vkCmdPushConstants(m_commandBuffer, m_denoiseCompPipelineLayout,
+      VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise),
+      &m_pcDenoise);
+    vkCmdDispatch(m_commandBuffer,
+      (m_renderSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+      m_renderSize.height, 1);
+
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_DEPENDENCY_DEVICE_GROUP_BIT, 1, &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
 
   int stepwidth = 1;
   for (int a = 0; a < m_num_atrous_iterations; a++) {
 
     // Tell the A-Trous algorithm its "hole" size
     m_pcDenoise.stepwidth = stepwidth;
+    m_pcDenoise.lastPass = a == m_num_atrous_iterations - 1;
+    m_pcDenoise.outImage = m_denoiseHandles[a % 2];
+    m_pcDenoise.outVariance = m_denoiseVarHandles[(a + 1) % 2];
     stepwidth *= 2;
 
-    // Select the compute shader, and its descriptor set and push constant
-    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
-    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-      m_denoiseCompPipelineLayout, 0, 1,
-      &m_denoiseDesc.descSet, 0, nullptr);
+    // Push this pass's constants
     vkCmdPushConstants(m_commandBuffer, m_denoiseCompPipelineLayout,
       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise),
       &m_pcDenoise);
@@ -104,16 +190,61 @@ void VkApp::denoise()
     // This MUST match the shaders's line:
     //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
     vkCmdDispatch(m_commandBuffer,
-      (m_windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
-      m_windowSize.height, 1);
+      (m_renderSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+      m_renderSize.height, 1);
 
-    // Wait until denoise shader is done writing to m_denoiseBuffer
-    imgMemBarrier.image = m_denoiseBuffer.image;
+    // Wait until the pass is done writing, for the next pass (or
+    // whichever of taa, upscale and sharpen follows)
     vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
       VK_DEPENDENCY_DEVICE_GROUP_BIT,
-      0, nullptr, 0, nullptr, 1, &imgMemBarrier);
+      1, &memBarrier, 0, nullptr, 0, nullptr);
 
-    CmdCopyImage(m_denoiseBuffer, m_renderTarget);
+    // ... and swap:  this pass's outputs are the next one's inputs
+    m_pcDenoise.inImage = m_pcDenoise.outImage;
+    m_pcDenoise.inVariance = m_pcDenoise.outVariance;
+    m_denoiseOutput = m_pcDenoise.outImage;
   }
+
+  vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      m_timestampPool, TS_DENOISE_END);
+  m_denoiseStatsPending = true;
+  m_denoiseMeasured = measure;
+}
+
+// Fold last frame's denoise time, and its quality measure if taken,
+// into the report window.
+void VkApp::readDenoiseStats()
+{
+  if (!m_denoiseStatsPending)
+    return;
+  m_reportDenoiseMs += timestampMs(TS_DENOISE_BEGIN, TS_DENOISE_END);
+  m_reportDenoiseFrames++;
+  if (m_denoiseMeasured) {
+    uint64_t err = (uint64_t(m_denoiseStats->errHi) << 32) | m_denoiseStats->errLo;
+    m_reportDenoiseErr += double(err) / 65536.0 / (double(m_renderSize.width) * m_renderSize.height);
+    m_reportMeasuredFrames++; }
+  m_denoiseStatsPending = false;
+}
+
+// Print the denoiser's GPU time and quality over the report window.
+// Quality is the temporal PSNR:  how little the output flickers from
+// frame to frame while the camera holds still, in dB.  Residual noise
+// shows as flicker, so the higher the better, and dB per ms of
+// denoise time compares the two modes' value for their cost.
+void VkApp::reportDenoise()
+{
+  if (m_reportDenoiseFrames > 0) {
+    float ms = m_reportDenoiseMs / m_reportDenoiseFrames;
+    printf("Denoiser (%s): %.2f ms", m_lastSvgf ? "variance-guided" : "edge-avoiding", ms);
+    if (m_reportMeasuredFrames > 0) {
+      double mse = std::max(m_reportDenoiseErr / m_reportMeasuredFrames, 1e-12);
+      double psnr = -10.0 * log10(mse);
+      printf(", %.1f dB temporal PSNR, %.1f dB/ms", psnr, ms > 0.0f ? psnr / ms : 0.0); }
+    printf("\n"); }
+
+  m_reportDenoiseFrames = 0;
+  m_reportMeasuredFrames = 0;
+  m_reportDenoiseMs = 0.0f;
+  m_reportDenoiseErr = 0.0;
 }
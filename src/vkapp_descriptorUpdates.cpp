@@ -0,0 +1,71 @@
+//////////////////////////////////////////////////////////////////////
+// Micro-benchmark of descriptor updates (-B).  The path tracer's
+// history pairs swap roles each traced frame by exchanging their
+// bindless handles in m_pcRay.  The alternative keeps the handles and
+// re-points them instead, rewriting the six history descriptors of
+// m_bindlessDesc each frame.  Once the startup is done, and before any
+// frame has been traced, this times that rewrite three ways:
+//   single:   one vkUpdateDescriptorSets per handle (DescriptorWrap::write)
+//   batched:  one vkUpdateDescriptorSets for all six (DescriptorBatch)
+//   template: one vkUpdateDescriptorSetWithTemplate (DescriptorWrap::createTemplate)
+// Frames alternate between the swapped and original images, and end
+// on the original.
+////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define BENCHMARK_FRAMES 10000  // Even, to end on the original images
+
+void VkApp::benchmarkDescriptorUpdates()
+{
+    // Each handle, and the image it starts out on (see createRtBuffers)
+    std::vector<uint> handles = {
+        m_pcRay.colCurr, m_pcRay.colPrev, m_pcRay.ndCurr, m_pcRay.ndPrev,
+        m_pcRay.momCurr, m_pcRay.momPrev};
+    std::vector<ImageWrap*> images = {
+        &m_rtColBuffer[0], &m_rtColBuffer[1], &m_rtNdBuffer[0], &m_rtNdBuffer[1],
+        &m_rtMomBuffer[0], &m_rtMomBuffer[1]};
+    std::vector<ImageWrap*> swapped = {
+        &m_rtColBuffer[1], &m_rtColBuffer[0], &m_rtNdBuffer[1], &m_rtNdBuffer[0],
+        &m_rtMomBuffer[1], &m_rtMomBuffer[0]};
+
+    auto report = [&](const char* method, double start) {
+        double us = (glfwGetTime() - start) * 1.0e6 / BENCHMARK_FRAMES;
+        printf("  %-8s  %7.3f us/frame, %6.3f us/descriptor\n",
+               method, us, us / handles.size()); };
+
+    printf("Descriptor updates, %zu storage images a frame, over %d frames:\n",
+           handles.size(), BENCHMARK_FRAMES);
+
+    double start = glfwGetTime();
+    for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+        std::vector<ImageWrap*>& source = frame % 2 ? images : swapped;
+        for (size_t i = 0; i < handles.size(); i++)
+            m_bindlessDesc.write(m_device, BINDLESS_IMAGES, handles[i], source[i]->Descriptor()); }
+    report("single", start);
+
+    start = glfwGetTime();
+    for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+        std::vector<ImageWrap*>& source = frame % 2 ? images : swapped;
+        DescriptorBatch batch;
+        for (size_t i = 0; i < handles.size(); i++)
+            batch.write(m_bindlessDesc, BINDLESS_IMAGES, handles[i], source[i]->Descriptor());
+        batch.flush(m_device); }
+    report("batched", start);
+
+    m_bindlessDesc.createTemplate(m_device, BINDLESS_IMAGES, handles);
+    start = glfwGetTime();
+    std::vector<DescriptorData> data(handles.size());
+    for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+        std::vector<ImageWrap*>& source = frame % 2 ? images : swapped;
+        for (size_t i = 0; i < handles.size(); i++)
+            data[i].image = source[i]->Descriptor();
+        m_bindlessDesc.writeTemplate(m_device, data); }
+    report("template", start);
+}
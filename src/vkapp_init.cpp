@@ -23,16 +23,84 @@ void VkApp::destroyAllVulkanResources()
     vkWaitForFences(m_device, 1, &m_waitFence, VK_TRUE, UINT64_MAX);
     vkResetFences(m_device, 1, &m_waitFence);
     vkDeviceWaitIdle(m_device);
+
+    destroyRecordWorkers();
     
     #ifdef GUI
     vkDestroyDescriptorPool(m_device, m_imguiDescPool, nullptr);
     ImGui_ImplVulkan_Shutdown();
     #endif
 
+    vkDestroyQueryPool(m_device, m_timestampPool, nullptr);
+
+    vkDestroyPipelineLayout(m_device, m_rqPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_rqPipeline, nullptr);
+    vkUnmapMemory(m_device, m_rayStatsBuff.memory);
+    m_rayStatsBuff.destroy(m_device);
+
+    vkDestroyPipelineLayout(m_device, m_upscalePipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_upscalePipeline, nullptr);
+    vkDestroyPipeline(m_device, m_sharpenPipeline, nullptr);
+    m_upscaleDesc.destroy(m_device);
+    m_upscaleBuffer.destroy(m_device);
+
+    vkDestroyPipelineLayout(m_device, m_taaPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_taaPipeline, nullptr);
+    m_taaDesc.destroy(m_device);
+    m_taaHistory.destroy(m_device);
+
+    vkDestroyPipelineLayout(m_device, m_reprojectPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_reprojectPipeline, nullptr);
+    m_motionBuffer.destroy(m_device);
+    m_instanceMotionBuff.destroy(m_device);
+    m_instanceTransformBuff.destroy(m_device);
+    vkUnmapMemory(m_device, m_instanceTransformStaging.memory);
+    m_instanceTransformStaging.destroy(m_device);
+
+    vkDestroyPipelineLayout(m_device, m_visibilityPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_visibilityPipeline, nullptr);
+    vkDestroyFramebuffer(m_device, m_visibilityFramebuffer, nullptr);
+    vkDestroyRenderPass(m_device, m_visibilityRenderPass, nullptr);
+    m_visibilityBuffer.destroy(m_device);
+    m_visibilityDepth.destroy(m_device);
+
+    vkDestroyQueryPool(m_device, m_wfTimestampPool, nullptr);
+    for (VkPipeline pipeline : m_wfPipelines)
+        vkDestroyPipeline(m_device, pipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_wfPipelineLayout, nullptr);
+    m_wfDesc.destroy(m_device);
+    vkUnmapMemory(m_device, m_wfStatsBuff.memory);
+    m_wfStatsBuff.destroy(m_device);
+    m_wfBinBuff.destroy(m_device);
+    m_wfCounterBuff.destroy(m_device);
+    m_wfShadowBuff.destroy(m_device);
+    m_wfSortedBuff.destroy(m_device);
+    m_wfQueueBuff[1].destroy(m_device);
+    m_wfQueueBuff[0].destroy(m_device);
+    m_wfFirstHitBuff.destroy(m_device);
+    m_wfHitBuff.destroy(m_device);
+    m_wfPathBuff.destroy(m_device);
+
+    vkDestroyPipelineLayout(m_device, m_variancePipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_variancePipeline, nullptr);
+    m_varianceDesc.destroy(m_device);
+    vkUnmapMemory(m_device, m_adaptiveStatsBuff.memory);
+    m_adaptiveStatsBuff.destroy(m_device);
+    m_rtMomBuffer[0].destroy(m_device);
+    m_rtMomBuffer[1].destroy(m_device);
+    m_sampleMask.destroy(m_device);
+
     vkDestroyPipelineLayout(m_device, m_denoiseCompPipelineLayout, nullptr);
     vkDestroyPipeline(m_device, m_denoisePipeline, nullptr);
+    vkDestroyPipeline(m_device, m_estimateVariancePipeline, nullptr);
     m_denoiseDesc.destroy(m_device);
-    m_denoiseBuffer.destroy(m_device);
+    m_denoiseBuffer[0].destroy(m_device);
+    m_denoiseBuffer[1].destroy(m_device);
+    m_denoisePrevBuffer.destroy(m_device);
+    m_denoiseVarBuffer[0].destroy(m_device);
+    m_denoiseVarBuffer[1].destroy(m_device);
+    vkUnmapMemory(m_device, m_denoiseStatsBuff.memory);
+    m_denoiseStatsBuff.destroy(m_device);
 
     m_shaderBindingTableBuff.destroy(m_device);
 
@@ -59,22 +127,63 @@ void VkApp::destroyAllVulkanResources()
     m_rtBuilder.destroy();
     printf("Rt Builder destroyed.\n");
 
-    m_rtColCurrBuffer.destroy(m_device);
-    m_rtColPrevBuffer.destroy(m_device);
-    m_rtKdCurrBuffer.destroy(m_device);
-    m_rtKdPrevBuffer.destroy(m_device);
-    m_rtNdCurrBuffer.destroy(m_device);
-    m_rtNdPrevBuffer.destroy(m_device);
+    m_rtColBuffer[0].destroy(m_device);
+    m_rtColBuffer[1].destroy(m_device);
+    m_rtKdBuffer.destroy(m_device);
+    m_rtNdBuffer[0].destroy(m_device);
+    m_rtNdBuffer[1].destroy(m_device);
     printf("Rt Buffers destroyed.\n");
 
     m_postDesc.destroy(m_device);
     printf("Post descriptor set destroyed.\n");
 
+    vkDestroyPipelineLayout(m_device, m_tonemapPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_histogramPipeline, nullptr);
+    vkDestroyPipeline(m_device, m_exposurePipeline, nullptr);
+    vkDestroyPipeline(m_device, m_tonemapPipeline, nullptr);
+    m_tonemapDesc.destroy(m_device);
+    vkUnmapMemory(m_device, m_tonemapStatsBuff.memory);
+    m_tonemapStatsBuff.destroy(m_device);
+    releaseSampler(m_displayBuffer);
+    m_displayBuffer.destroy(m_device);
+
     if (m_renderTarget.image != VK_NULL_HANDLE) {
+      releaseSampler(m_renderTarget);
       m_renderTarget.destroy(m_device);
       printf("Render target destroyed.\n");
     }
 
+    vkDestroyPipelineLayout(m_device, m_scIndirectPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_scIndirectPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_meshletPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_meshletPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_cullPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_cullPipeline, nullptr);
+    for (CullList* list : {&m_cullMeshes, &m_cullMeshlets}) {
+        list->desc.destroy(m_device);
+        list->instanceBuff.destroy(m_device);
+        list->drawBuff.destroy(m_device);
+        list->countBuff.destroy(m_device);
+        list->visibleBuff.destroy(m_device); }
+    vkDestroyPipelineLayout(m_device, m_hizPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_hizPipeline, nullptr);
+    m_hizDesc.destroy(m_device);
+    for (VkImageView view : m_hizLevelViews)
+        vkDestroyImageView(m_device, view, nullptr);
+    releaseSampler(m_hizImage);
+    m_hizImage.destroy(m_device);
+    vkDestroyRenderPass(m_device, m_scLateRenderPass, nullptr);
+    vkDestroyPipelineLayout(m_device, m_deferredPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_deferredPipeline, nullptr);
+    m_deferredDesc.destroy(m_device);
+    vkDestroyPipelineLayout(m_device, m_idPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_idPipeline, nullptr);
+    vkDestroyFramebuffer(m_device, m_idFramebuffer, nullptr);
+    vkDestroyRenderPass(m_device, m_idRenderPass, nullptr);
+    m_idBuffer.destroy(m_device);
+    vkUnmapMemory(m_device, m_cullStatsBuff.memory);
+    m_cullStatsBuff.destroy(m_device);
+
     if (m_scPipelineLayout != VK_NULL_HANDLE) 
     {
       vkDestroyPipelineLayout(m_device, m_scPipelineLayout, nullptr);
@@ -90,6 +199,11 @@ void VkApp::destroyAllVulkanResources()
     m_scDesc.destroy(m_device);
     printf("Sc descriptor set destroyed.\n");
 
+    m_bindlessDesc.destroy(m_device);
+    for (ImageWrap& texture : m_objText) {
+        releaseSampler(texture);
+        texture.destroy(m_device); }
+
     if (m_scRenderPass != VK_NULL_HANDLE) 
     {
       vkDestroyRenderPass(m_device, m_scRenderPass, nullptr);
@@ -186,6 +300,9 @@ void VkApp::destroyAllVulkanResources()
       m_postPipeline = VK_NULL_HANDLE;
     }
 
+    savePipelineCache();  // For the next run
+    destroySamplers();
+
     if (m_cmdPool != VK_NULL_HANDLE) 
     {
       vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
@@ -353,9 +470,8 @@ void VkApp::createPhysicalDevice()
     throw std::runtime_error("Failed to find a compatible GPU!");
   }
 
-  VkPhysicalDeviceProperties selectedGPUProperties;
-  vkGetPhysicalDeviceProperties(m_physicalDevice, &selectedGPUProperties);
-  printf("Physical device selected: %s\n", selectedGPUProperties.deviceName);
+  vkGetPhysicalDeviceProperties(m_physicalDevice, &m_deviceProperties);
+  printf("Physical device selected: %s\n", m_deviceProperties.deviceName);
 }
 
 
@@ -386,14 +502,36 @@ void VkApp::chooseQueueIndex()
 
 void VkApp::createDevice()
 {
+    // Mesh shaders, for the meshlet raster, and ray queries, for the
+    // ray query and wavefront tracers, where the device has them
+    uint32_t extCount;
+    vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extCount, nullptr);
+    std::vector<VkExtensionProperties> extensionProperties(extCount);
+    vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extCount, extensionProperties.data());
+    bool meshShaderExt = false;
+    bool rayQueryExt = false;
+    for (const auto& ext : extensionProperties) {
+        if (std::string(ext.extensionName) == VK_EXT_MESH_SHADER_EXTENSION_NAME)
+            meshShaderExt = true;
+        if (std::string(ext.extensionName) == VK_KHR_RAY_QUERY_EXTENSION_NAME)
+            rayQueryExt = true; }
+
     // =============
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeature{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT};
+    meshShaderFeature.pNext = nullptr;
+
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeature{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR};
-    rtPipelineFeature.pNext = nullptr;
+    rtPipelineFeature.pNext = meshShaderExt ? &meshShaderFeature : nullptr;
+
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeature{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR};
+    rayQueryFeature.pNext = &rtPipelineFeature;
 
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
-    accelFeature.pNext = &rtPipelineFeature;
+    accelFeature.pNext = rayQueryExt ? (void*)&rayQueryFeature : (void*)&rtPipelineFeature;
 
     VkPhysicalDeviceVulkan13Features features13{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES};
@@ -415,6 +553,40 @@ void VkApp::createDevice()
     // Ask Vulkan to fill in all structures on the pNext chain
     vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features2);
 
+    // The packed G-buffer images (rg32ui, rg32f, r16f) are storage
+    // image extended formats.
+    if (!features2.features.shaderStorageImageExtendedFormats)
+        throw std::runtime_error("Device does not support shaderStorageImageExtendedFormats!");
+
+    // The GPU-driven raster's draws;  without it, only the per-instance raster.
+    m_drawIndirectCount = features12.drawIndirectCount;
+
+    // The bindless table's arrays (see vkapp_bindless.cpp)
+    if (!features12.runtimeDescriptorArray
+        || !features12.descriptorBindingPartiallyBound
+        || !features12.descriptorBindingVariableDescriptorCount
+        || !features12.descriptorBindingStorageBufferUpdateAfterBind
+        || !features12.descriptorBindingStorageImageUpdateAfterBind
+        || !features12.descriptorBindingSampledImageUpdateAfterBind)
+        throw std::runtime_error("Device does not support the bindless table's descriptor indexing!");
+
+    // Only the task and mesh shaders themselves;  the rest need other
+    // features or extensions.
+    m_meshShader = meshShaderFeature.taskShader && meshShaderFeature.meshShader;
+    meshShaderFeature.multiviewMeshShader = VK_FALSE;
+    meshShaderFeature.primitiveFragmentShadingRateMeshShader = VK_FALSE;
+    meshShaderFeature.meshShaderQueries = VK_FALSE;
+    if (m_meshShader)
+        reqDeviceExtensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    else
+        rtPipelineFeature.pNext = nullptr;
+
+    m_rayQuery = rayQueryExt && rayQueryFeature.rayQuery;
+    if (m_rayQuery)
+        reqDeviceExtensions.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+    else
+        accelFeature.pNext = &rtPipelineFeature;
+
     float priority = 1.0;
     VkDeviceQueueCreateInfo queueInfo{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
     queueInfo.queueFamilyIndex = m_graphicsQueueIndex;
@@ -713,6 +885,17 @@ void VkApp::createSwapchain()
     NAME(m_writtenSemaphore, VK_OBJECT_TYPE_SEMAPHORE, "m_writtenSemaphore");
         
     m_windowSize = swapchainExtent;
+
+    // The path tracer renders at a fraction of the window size, and the
+    // TAA pass or the spatial upscaler upsamples.  Its images are
+    // allocated at m_maxRenderSize;  with dynamic resolution it renders
+    // into the top left m_renderSize of them.  See vkapp_upscale.cpp.
+    m_maxRenderSize.width = std::max(1u, uint32_t(m_windowSize.width * app->renderScale + 0.5f));
+    m_maxRenderSize.height = std::max(1u, uint32_t(m_windowSize.height * app->renderScale + 0.5f));
+    m_renderSize = m_maxRenderSize;
+    m_renderScale = app->renderScale;
+    printf("Render size: %dx%d of %dx%d\n", m_renderSize.width, m_renderSize.height,
+           m_windowSize.width, m_windowSize.height);
     
 }
 
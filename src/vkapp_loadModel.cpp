@@ -9,6 +9,7 @@
 #include <vector>
 #include <array>
 #include <math.h>
+#include <cfloat>
 
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -39,6 +40,10 @@ struct ModelData
     std::vector<Material> materials;
     std::vector<int32_t>     matIndx;
     std::vector<std::string> textures;
+    std::vector<MeshRange>   meshes;
+    std::vector<Meshlet>     meshlets;
+    std::vector<uint32_t>    meshletVertices;   // Each meshlet's vertices
+    std::vector<uint32_t>    meshletTriangles;  // Each triangle's indices into its meshlet's, packed
 
     bool readAssimpFile(const std::string& path, const glm::mat4& M);
 };
@@ -50,6 +55,92 @@ void recurseModelNodes(ModelData* meshdata,
                        const int level=0);
 
 
+// The range of meshdata's indices as a MeshRange, bounded by the
+// sphere about its bounding box's center.
+static MeshRange meshBounds(const ModelData& meshdata, uint32_t firstIndex, uint32_t indexCount)
+{
+    vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (uint32_t i = firstIndex;  i < firstIndex + indexCount;  i++) {
+        lo = glm::min(lo, meshdata.vertices[meshdata.indices[i]].pos);
+        hi = glm::max(hi, meshdata.vertices[meshdata.indices[i]].pos); }
+    vec3 center = 0.5f * (lo + hi);
+    float radius = 0.0f;
+    for (uint32_t i = firstIndex;  i < firstIndex + indexCount;  i++)
+        radius = std::max(radius, glm::length(meshdata.vertices[meshdata.indices[i]].pos - center));
+    return {vec4(center, radius), firstIndex, indexCount};
+}
+
+// The normal cone (see Meshlet in vkapp.h) of the range of meshdata's
+// indices:  about their triangles' average normal, wide enough for
+// all of them.  Degenerate triangles face nowhere.
+static vec4 normalCone(const ModelData& meshdata, uint32_t firstIndex, uint32_t indexCount)
+{
+    std::vector<vec3> normals;
+    vec3 axis(0.0f);
+    for (uint32_t i = firstIndex;  i < firstIndex + indexCount;  i += 3) {
+        const vec3& p0 = meshdata.vertices[meshdata.indices[i + 0]].pos;
+        const vec3& p1 = meshdata.vertices[meshdata.indices[i + 1]].pos;
+        const vec3& p2 = meshdata.vertices[meshdata.indices[i + 2]].pos;
+        vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(n);
+        if (length > 0.0f) {
+            normals.push_back(n / length);
+            axis += n / length; } }
+
+    if (glm::length(axis) == 0.0f)
+        return vec4(0, 0, 1, 1);  // Never culled
+    axis = glm::normalize(axis);
+    float minDot = 1.0f;
+    for (const vec3& n : normals)
+        minDot = std::min(minDot, glm::dot(n, axis));
+    if (minDot <= 0.0f)
+        return vec4(axis, 1);  // A hemisphere or more
+    return vec4(axis, std::sqrt(1.0f - minDot * minDot));
+}
+
+// Partition each mesh into meshlets:  runs of its triangles, each
+// ended where the next triangle would take it past
+// MESHLET_MAX_VERTICES or MESHLET_MAX_TRIANGLES.  The triangles keep
+// their order, so each meshlet is a range of the indices, and the
+// per-triangle material indices, LOD biases and emitters hold as
+// they are.  Also lists each meshlet's vertices, and each triangle's
+// 8 bit indices into its meshlet's list.
+static void buildMeshlets(ModelData& meshdata)
+{
+    meshdata.meshletTriangles.assign(meshdata.indices.size() / 3, 0);
+    std::vector<int32_t> local(meshdata.vertices.size(), -1);  // Index in the current meshlet's list
+    for (const MeshRange& mesh : meshdata.meshes) {
+        uint32_t end = mesh.firstIndex + mesh.indexCount;
+        for (uint32_t first = mesh.firstIndex;  first < end;  ) {
+            Meshlet meshlet{};
+            meshlet.firstIndex = first;
+            meshlet.vertexOffset = static_cast<uint32_t>(meshdata.meshletVertices.size());
+
+            uint32_t i = first;
+            for ( ;  i < end && (i - first) / 3 < MESHLET_MAX_TRIANGLES;  i += 3) {
+                uint32_t added = 0;
+                for (int k = 0;  k < 3;  k++)
+                    added += local[meshdata.indices[i + k]] < 0;
+                if (meshlet.vertexCount + added > MESHLET_MAX_VERTICES)
+                    break;
+                uint32_t packed = 0;
+                for (int k = 0;  k < 3;  k++) {
+                    uint32_t v = meshdata.indices[i + k];
+                    if (local[v] < 0) {
+                        local[v] = meshlet.vertexCount++;
+                        meshdata.meshletVertices.push_back(v); }
+                    packed |= uint32_t(local[v]) << (8 * k); }
+                meshdata.meshletTriangles[i / 3] = packed; }
+
+            meshlet.indexCount = i - first;
+            for (uint32_t v = meshlet.vertexOffset;  v < meshdata.meshletVertices.size();  v++)
+                local[meshdata.meshletVertices[v]] = -1;
+            meshlet.sphere = meshBounds(meshdata, first, meshlet.indexCount).sphere;
+            meshlet.cone = normalCone(meshdata, first, meshlet.indexCount);
+            meshdata.meshlets.push_back(meshlet);
+            first = i; } }
+}
+
 // Returns an address (as VkDeviceAddress=uint64_t) of a buffer on the GPU.
 VkDeviceAddress getBufferDeviceAddress(VkDevice device, VkBuffer buffer) {
     VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
@@ -120,13 +211,20 @@ bool VkApp::loadModel(const std::string& filename, glm::mat4 transform)
     meshdata.materials.push_back({Z, Z, Sky, 0.0, -1});
     meshdata.matIndx.push_back(Nm);                       
     meshdata.matIndx.push_back(Nm);                             
+    meshdata.meshes.push_back(meshBounds(meshdata, meshdata.indices.size() - 6, 6));
 #endif
+
+    buildMeshlets(meshdata);
     
     printf("vertices: %zd\n", meshdata.vertices.size());
     printf("indices: %zd (%zd)\n", meshdata.indices.size(), meshdata.indices.size()/3);
     printf("materials: %zd\n", meshdata.materials.size());
     printf("matIndx: %zd\n", meshdata.matIndx.size());
     printf("textures: %zd\n", meshdata.textures.size());
+    printf("meshes: %zd\n", meshdata.meshes.size());
+    printf("meshlets: %zd (%.1f triangles, %.1f vertices each)\n", meshdata.meshlets.size(),
+           meshdata.indices.size() / 3.0 / meshdata.meshlets.size(),
+           double(meshdata.meshletVertices.size()) / meshdata.meshlets.size());
     
 
     std::vector<Emitter> lightList; 
@@ -195,9 +293,35 @@ bool VkApp::loadModel(const std::string& filename, glm::mat4 transform)
     );
     submitTempCmdBuffer(commandBuffer);
 
+    // Ray cone texture LOD: each triangle's texture-to-world area
+    // ratio, as 0.5*log2(uv area / area).  The ray generation shader
+    // adds the texture's size and the cone's footprint.
+    std::vector<float> lodBias(meshdata.matIndx.size(), 0.0f);
+    for (uint i = 0; i < meshdata.matIndx.size(); i++) {
+        const Vertex& v0 = meshdata.vertices[meshdata.indices[3 * i + 0]];
+        const Vertex& v1 = meshdata.vertices[meshdata.indices[3 * i + 1]];
+        const Vertex& v2 = meshdata.vertices[meshdata.indices[3 * i + 2]];
+        vec2 t1 = v1.texCoord - v0.texCoord;
+        vec2 t2 = v2.texCoord - v0.texCoord;
+        float uvArea = std::abs(t1.x * t2.y - t2.x * t1.y);
+        float area = glm::length(glm::cross(v1.pos - v0.pos, v2.pos - v0.pos));
+        if (uvArea > 0.0f && area > 0.0f)
+            lodBias[i] = 0.5f * std::log2(uvArea / area); }
+
+    // Creates the textures on the GPU, or finds them already there (see
+    // vkapp_textures.cpp), and points the materials at their m_objText
+    // entries, so that the object's txtOffset is 0.
+    std::vector<uint32_t> txtIndex = loadTextures(meshdata.textures);
+    for (Material& mat : meshdata.materials)
+        if (mat.textureId >= 0)
+            mat.textureId = txtIndex[mat.textureId];
+    reportTextures();
+
     ObjData object;
     object.nbIndices  = static_cast<uint32_t>(meshdata.indices.size());
     object.nbVertices = static_cast<uint32_t>(meshdata.vertices.size());
+    object.meshes     = meshdata.meshes;
+    object.meshlets   = meshdata.meshlets;
 
     // Create the buffers on Device and copy vertices, indices and materials
     VkCommandBuffer    cmdBuf = createTempCmdBuffer();
@@ -213,37 +337,48 @@ bool VkApp::loadModel(const std::string& filename, glm::mat4 transform)
                          VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rtFlags);
     initBufferWrapFromData(object.matColorBuffer, cmdBuf, meshdata.materials, flag);
     initBufferWrapFromData(object.matIndexBuffer, cmdBuf, meshdata.matIndx, flag);
+    initBufferWrapFromData(object.lodBiasBuffer, cmdBuf, lodBias, flag);
+    initBufferWrapFromData(object.meshletVertexBuffer, cmdBuf, meshdata.meshletVertices, flag);
+    initBufferWrapFromData(object.meshletTriangleBuffer, cmdBuf, meshdata.meshletTriangles, flag);
     
     NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.vertexBuffer");
     NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.indexBuffer");
     NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.matColorBuffer");
     NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.matIndexBuffer");
+    NAME(object.lodBiasBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.lodBiasBuffer");
+    NAME(object.meshletVertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.meshletVertexBuffer");
+    NAME(object.meshletTriangleBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.meshletTriangleBuffer");
     
   
     submitTempCmdBuffer(cmdBuf);
     
-    // Creates all textures on the GPU
-    auto txtOffset = static_cast<uint32_t>(m_objText.size());  // Offset is current size
-    for(const auto& texName : meshdata.textures)
-        m_objText.push_back(readTextureFile(texName));
-
     // Assuming one instance of an object with its supplied transform.
     // Could provide multiple transform here to make a vector of instances of this object.
     ObjInst instance;
     instance.transform = transform;
+    instance.prevTransform = transform;
     instance.objIndex  = static_cast<uint32_t>(m_objData.size()); // Index of current object
+    // Hits and the deferred raster's IDs carry the object index, which
+    // the instance motion and transforms are indexed by, as instances.
+    if (m_objInst.size() != instance.objIndex)
+        throw std::runtime_error("Each object must have exactly one instance, in order!");
     m_objInst.push_back(instance);
 
     // Creating information for device access
     ObjDesc desc;
-    desc.txtOffset            = txtOffset;
+    desc.txtOffset            = 0;  // The materials' textureId's are m_objText indices
+    desc.materialBase         = m_materialCount;
     desc.vertexAddress        = getBufferDeviceAddress(m_device, object.vertexBuffer.buffer);
     desc.indexAddress         = getBufferDeviceAddress(m_device, object.indexBuffer.buffer);
     desc.materialAddress      = getBufferDeviceAddress(m_device, object.matColorBuffer.buffer);
     desc.materialIndexAddress = getBufferDeviceAddress(m_device, object.matIndexBuffer.buffer);
+    desc.lodBiasAddress       = getBufferDeviceAddress(m_device, object.lodBiasBuffer.buffer);
+    desc.meshletVertexAddress = getBufferDeviceAddress(m_device, object.meshletVertexBuffer.buffer);
+    desc.meshletTriangleAddress = getBufferDeviceAddress(m_device, object.meshletTriangleBuffer.buffer);
 
     m_objData.emplace_back(object);
     m_objDesc.emplace_back(desc);
+    m_materialCount += static_cast<uint32_t>(meshdata.materials.size());
 
     return true;
 }
@@ -374,13 +509,19 @@ void recurseModelNodes(ModelData* meshdata,
         }
         
         // Loop through all faces, recording indices
+        uint firstIndex = meshdata->indices.size();
         for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t) {
             aiFace* aiface = &aimesh->mFaces[t];
             for (int i=2;  i<aiface->mNumIndices;  i++) {
                 meshdata->matIndx.push_back(aimesh->mMaterialIndex);
                 meshdata->indices.push_back(aiface->mIndices[0]+faceOffset);
                 meshdata->indices.push_back(aiface->mIndices[i-1]+faceOffset);
-                meshdata->indices.push_back(aiface->mIndices[i]+faceOffset); } }; }
+                meshdata->indices.push_back(aiface->mIndices[i]+faceOffset); } };
+
+        // The mesh's range of indices, for the GPU-driven raster's culling
+        uint indexCount = meshdata->indices.size() - firstIndex;
+        if (indexCount > 0)
+            meshdata->meshes.push_back(meshBounds(*meshdata, firstIndex, indexCount)); }
 
 
     // Recurse onto this node's children
@@ -388,23 +529,13 @@ void recurseModelNodes(ModelData* meshdata,
         recurseModelNodes(meshdata, aiscene, node->mChildren[i], childTr, level+1);
 }
 
-ImageWrap VkApp::readTextureFile(std::string fileName)
+// Upload a texture decoded by VkApp::loadTextures, and mipmap it.
+ImageWrap VkApp::readTextureFile(const DecodedTexture& texture)
 {
-    for (int i=0;  i<fileName.size();  i++)
-        if (fileName[i] == '\\') fileName[i] = '/';
-    
     //VkImage& textureImage, VkDeviceMemory& textureImageMemory
-    int texWidth, texHeight, texChannels;
-
-    stbi_set_flip_vertically_on_load(true);
-    stbi_uc* pixels = stbi_load(fileName.c_str(), &texWidth, &texHeight, &texChannels,
-                                STBI_rgb_alpha);
+    int texWidth = texture.width, texHeight = texture.height;
     VkDeviceSize imageSize = texWidth * texHeight * 4;
 
-    if (!pixels) {
-        throw std::runtime_error("failed to load texture image!");
-    }
-
     BufferWrap staging;
     initBufferWrap(staging, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
@@ -412,11 +543,9 @@ ImageWrap VkApp::readTextureFile(std::string fileName)
 
     void* data;
     vkMapMemory(m_device, staging.memory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
+    memcpy(data, texture.pixels.get(), static_cast<size_t>(imageSize));
     vkUnmapMemory(m_device, staging.memory);
 
-    stbi_image_free(pixels);
-
     uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
     
     ImageWrap myImage;
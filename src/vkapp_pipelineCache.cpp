@@ -0,0 +1,111 @@
+//////////////////////////////////////////////////////////////////////
+// Persistent pipeline cache.  Every pipeline (and ImGui's) is created
+// through m_pipelineCache, which createPipelineCache seeds from
+// pipelineCacheFile, and savePipelineCache writes back at exit, so a
+// warm start skips most of the drivers' shader compilation -- the ray
+// tracing pipeline's in particular.  The file starts with a header
+// naming the device and driver it was written by;  a cache from any
+// other is ignored, as the driver would reject it (or worse) anyway.
+// Each pipeline's creation time is logged to show the saving.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+
+static const char* pipelineCacheFile = "pipeline.cache";
+
+// Precedes the driver's cache data in pipelineCacheFile
+struct PipelineCacheFileHeader
+{
+    uint32_t magic;          // pipelineCacheMagic
+    uint32_t dataSize;       // Bytes of cache data following the header
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  uuid[VK_UUID_SIZE];  // VkPhysicalDeviceProperties::pipelineCacheUUID
+};
+static const uint32_t pipelineCacheMagic = 0x43505452;  // "RTPC"
+
+void VkApp::createPipelineCache()
+{
+    // Load the last run's cache, if it was written by this device and driver.
+    std::vector<char> data;
+    std::ifstream stream(pipelineCacheFile, std::ios::binary);
+    PipelineCacheFileHeader header{};
+    if (stream.read((char*)&header, sizeof(header))) {
+        if (header.magic != pipelineCacheMagic
+            || header.vendorID != m_deviceProperties.vendorID
+            || header.deviceID != m_deviceProperties.deviceID
+            || header.driverVersion != m_deviceProperties.driverVersion
+            || memcmp(header.uuid, m_deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+            printf("Pipeline cache: %s is from another device or driver;  ignored\n", pipelineCacheFile);
+        else {
+            data.resize(header.dataSize);
+            if (!stream.read(data.data(), data.size())) {
+                printf("Pipeline cache: %s is truncated;  ignored\n", pipelineCacheFile);
+                data.clear(); } } }
+
+    VkPipelineCacheCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
+    if (vkCreatePipelineCache(m_device, &createInfo, nullptr, &m_pipelineCache) != VK_SUCCESS) {
+        // The driver rejected the data;  start empty.
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        data.clear();
+        if (vkCreatePipelineCache(m_device, &createInfo, nullptr, &m_pipelineCache) != VK_SUCCESS)
+            throw std::runtime_error("Failed to create the pipeline cache!"); }
+    NAME(m_pipelineCache, VK_OBJECT_TYPE_PIPELINE_CACHE, "m_pipelineCache");
+
+    m_pipelineCacheWarm = !data.empty();
+    printf("Pipeline cache: %s (%zu bytes)\n", m_pipelineCacheWarm ? "warm start" : "cold start", data.size());
+}
+
+// Log a pipeline's creation time, started at the given glfwGetTime().
+void VkApp::logPipelineTime(const char* name, double start)
+{
+    float ms = float(glfwGetTime() - start) * 1000.0f;
+    std::lock_guard<std::mutex> lock(m_pipelineTimeMutex);
+    m_pipelineCreateMs += ms;
+    m_pipelineCount++;
+    printf("Pipeline %s: %.2f ms\n", name, ms);
+}
+
+// Write the cache back for the next run, and destroy it.
+void VkApp::savePipelineCache()
+{
+    if (m_pipelineCache == VK_NULL_HANDLE)
+        return;
+    printf("Pipeline cache: %d pipelines created in %.1f ms (%s start)\n",
+           m_pipelineCount, m_pipelineCreateMs, m_pipelineCacheWarm ? "warm" : "cold");
+
+    size_t size = 0;
+    std::vector<char> data;
+    if (vkGetPipelineCacheData(m_device, m_pipelineCache, &size, nullptr) == VK_SUCCESS && size > 0) {
+        data.resize(size);
+        if (vkGetPipelineCacheData(m_device, m_pipelineCache, &size, data.data()) != VK_SUCCESS)
+            size = 0; }
+
+    if (size > 0) {
+        PipelineCacheFileHeader header{pipelineCacheMagic, uint32_t(size), m_deviceProperties.vendorID,
+                                       m_deviceProperties.deviceID, m_deviceProperties.driverVersion};
+        memcpy(header.uuid, m_deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+        std::ofstream stream(pipelineCacheFile, std::ios::binary | std::ios::trunc);
+        stream.write((const char*)&header, sizeof(header));
+        stream.write(data.data(), size);
+        if (stream)
+            printf("Pipeline cache: wrote %zu bytes to %s\n", size, pipelineCacheFile);
+        else
+            printf("Pipeline cache: could not write %s\n", pipelineCacheFile); }
+
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
+    m_pipelineCache = VK_NULL_HANDLE;
+}
@@ -13,11 +13,18 @@
 
 void VkApp::createDepthResource() 
 {
+    // The raster's occlusion culling samples the depth, if the format
+    // allows it.
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, VK_FORMAT_X8_D24_UNORM_PACK32, &formatProperties);
+    m_hizSupported = formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+
     // Note m_depthImage is type ImageWrap; a tiny wrapper around
     // several related Vulkan objects.
     initImageWrap(m_depthImage, m_windowSize,
                   VK_FORMAT_X8_D24_UNORM_PACK32,
-                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+                  | (m_hizSupported ? VK_IMAGE_USAGE_SAMPLED_BIT : 0),
                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                   VK_IMAGE_ASPECT_DEPTH_BIT,
                   VK_IMAGE_LAYOUT_UNDEFINED,
@@ -230,8 +237,10 @@ void VkApp::createPostPipeline()
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+    double start = glfwGetTime();
+    vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr,
                               &m_postPipeline);
+    logPipelineTime("post", start);
  
     // The pipeline has fully compiled copies of the shaders, so these
     // intermediate (SPV) versions can be destroyed.
@@ -240,26 +249,8 @@ void VkApp::createPostPipeline()
 
 }
 
-// Read a file's bytes into a string
-std::string VkApp::loadFile(const std::string& filename)
-{
-    std::string   result;
-    std::ifstream stream(filename, std::ios::ate | std::ios::binary);  //ate: Open at file end
-
-    if(!stream.is_open())
-        throw std::runtime_error("Can not open a shader file.\n");
-
-    result.reserve(stream.tellg()); // tellg() is last char position in file (i.e.,  length)
-
-    // Seek back to the beginning of the file and read it's contents
-    stream.seekg(0, std::ios::beg);
-    result.assign((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
-
-    return result;
-}
-
 //-------------------------------------------------------------------------------------------------
-// Post processing pass: tone mapper, UI
+// Post processing pass: the tone mapped image (see vkapp_tonemap.cpp), UI
 void VkApp::postProcess()
 {
     std::array<VkClearValue, 2> clearValues{};
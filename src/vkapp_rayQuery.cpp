@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////////
+// Ray query backend.  raytrace.comp runs the same path tracer
+// (shaders/pathtrace.glsl) as the ray tracing pipeline, but as a
+// compute shader casting inline ray queries, so there is no SBT and
+// no switching to hit and miss shaders.  Selected at startup with -q;
+// both backends report frames/s and rays/s for comparison.
+////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+void VkApp::createRqPipeline()
+{
+    // Same descriptor sets and push constants as the ray tracing
+    // pipeline, but for the compute stage.
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantRay)};
+    std::vector<VkDescriptorSetLayout> rqDescSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout, m_bindlessDesc.descSetLayout};
+
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.setLayoutCount = static_cast<uint32_t>(rqDescSetLayouts.size());
+    plCreateInfo.pSetLayouts = rqDescSetLayouts.data();
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_rqPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_rqPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/raytrace.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    double start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_rqPipeline);
+    logPipelineTime("raytrace.comp", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+// Fold the last traced frame's ray count and trace time into the
+// current report window, and print the window's rates once a second
+// has passed.
+void VkApp::reportTraceRate()
+{
+    if (m_rayStatsPending) {
+        m_reportRays += m_rayStats->rays;
+        m_reportActiveIters += m_rayStats->activeIters;
+        m_reportLaneIters += m_rayStats->laneIters;
+        m_reportTraceMs += timestampMs(TS_TRACE_BEGIN, TS_TRACE_END);
+        m_reportReprojectMs += timestampMs(TS_TRACE_END, TS_REPROJECT_END);
+        if (useWavefront)
+            readWavefrontStats();
+        m_rayStatsPending = false; }
+    readDenoiseStats();
+    m_reportFrames++;
+
+    double now = glfwGetTime();
+    if (m_reportStart == 0.0)
+        m_reportStart = now;
+    double elapsed = now - m_reportStart;
+    if (elapsed < 1.0)
+        return;
+
+    // Hybrid rendering casts no primary rays, so its comparison with
+    // pure path tracing is in the frame rate and trace time.
+    printf("%s%s: %.1f frames/s (%.2f ms trace, %.2f ms reproject), %.1f Mrays/s (%.1f Mrays/s of trace time)",
+           useWavefront ? "Wavefront" : useRayQuery ? "Ray query" : "Ray pipeline",
+           m_pcRay.hybrid ? ", raster primary" : "",
+           m_reportFrames / elapsed,
+           m_reportTraceMs / m_reportFrames,
+           m_reportReprojectMs / m_reportFrames,
+           m_reportRays / elapsed / 1.0e6,
+           m_reportTraceMs > 0.0f ? m_reportRays / (m_reportTraceMs * 1.0e3) : 0.0);
+    if (useWavefront) {
+        printf("\n");
+        reportWavefront(m_reportFrames); }
+    else
+        printf(", %.0f%% lane utilization\n",
+               m_reportLaneIters > 0 ? 100.0 * m_reportActiveIters / m_reportLaneIters : 0.0);
+    reportDenoise();
+
+    m_reportRays = 0;
+    m_reportActiveIters = 0;
+    m_reportLaneIters = 0;
+    m_reportFrames = 0;
+    m_reportTraceMs = 0.0f;
+    m_reportReprojectMs = 0.0f;
+    m_reportStart = now;
+}
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <algorithm>
 #include <math.h>
 
 #include "vkapp.h"
@@ -20,38 +21,82 @@ using namespace glm;
 void VkApp::createRtBuffers()
 {
     
-    VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    // Color history in half floats, albedo in 8 bit unorms, and the
+    // normal:depth pair packed into 64 bits: less than half the memory
+    // and bandwidth of four 32 bit floats per pixel.
+    VkFormat format = colorFormat;
     VkImageUsageFlags flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
     VkMemoryPropertyFlags mem = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
     VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
 
-    initImageWrap(m_rtColCurrBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    NAME(m_rtColCurrBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_rtColCurrBuffer");
-
-    initImageWrap(m_rtColPrevBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    NAME(m_rtColPrevBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_rtColPrevBuffer");
-
-    // Current and Previous Kd (Diffuse Color) Buffers
-    initImageWrap(m_rtKdCurrBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    NAME(m_rtKdCurrBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_rtKdCurrBuffer");
-
-    initImageWrap(m_rtKdPrevBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    NAME(m_rtKdPrevBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_rtKdPrevBuffer");
-
-    // Current and Previous Nd (Normal Data) Buffers
-    initImageWrap(m_rtNdCurrBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    NAME(m_rtNdCurrBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_rtNdCurrBuffer");
-
-    initImageWrap(m_rtNdPrevBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    NAME(m_rtNdPrevBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_rtNdPrevBuffer");
+    // The history pairs are read and written by bindless handle;  each
+    // traced frame, raytrace swaps the handles of a pair, in m_pcRay,
+    // instead of copying this frame's image into last frame's.
+    for (int i = 0; i < 2; i++) {
+        initImageWrap(m_rtColBuffer[i], m_maxRenderSize, format, flags, mem, aspect, layout);
+        NAME(m_rtColBuffer[i].image, VK_OBJECT_TYPE_IMAGE, "m_rtColBuffer"); }
+    m_pcRay.colCurr = bindlessStorageImage(m_rtColBuffer[0]);
+    m_pcRay.colPrev = bindlessStorageImage(m_rtColBuffer[1]);
+
+    // Ray and lane counters per frame; read by the host after the frame's fence.
+    initBufferWrap(m_rayStatsBuff, sizeof(RayStats),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_rayStatsBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_rayStatsBuff");
+    vkMapMemory(m_device, m_rayStatsBuff.memory, 0, sizeof(RayStats), 0, (void**)&m_rayStats);
+
+    // The Kd (Diffuse Color) Buffer:  no pass reads last frame's.
+    initImageWrap(m_rtKdBuffer, m_maxRenderSize, kdFormat, flags, mem, aspect, layout);
+    NAME(m_rtKdBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_rtKdBuffer");
+
+    // The Nd (Normal Data) pair.  Integer texels can be neither
+    // sampled with a filter nor rendered to with blending.
+    VkImageUsageFlags ndFlags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    for (int i = 0; i < 2; i++) {
+        initImageWrap(m_rtNdBuffer[i], m_maxRenderSize, ndFormat, ndFlags, mem, aspect, layout);
+        NAME(m_rtNdBuffer[i].image, VK_OBJECT_TYPE_IMAGE, "m_rtNdBuffer"); }
+    m_pcRay.ndCurr = bindlessStorageImage(m_rtNdBuffer[0]);
+    m_pcRay.ndPrev = bindlessStorageImage(m_rtNdBuffer[1]);
 
 }
 
 // Initialize ray tracing
 void VkApp::initRayTracing()
 {
-    m_pcRay.exposure = 2.0;
+    // A sample count given on the command line is used as is;
+    // otherwise updateSamplesPerLaunch adapts it from frame timings.
+    m_fixedSamples = app->samplesPerLaunch > 0;
+    m_pcRay.samplesPerLaunch = m_fixedSamples ? app->samplesPerLaunch : 1;
+    m_targetFrameMs = app->targetFrameMs;
+
+    // -S draws with the scanline rasterizer instead;  the ray tracing
+    // resources are made either way.
+    useRaytracer = !app->useRasterizer;
+
+    // The wavefront tracer casts its rays with ray queries too, and
+    // traces one path per pixel over the whole screen each frame.
+    useWavefront = app->useWavefront;
+    useRayQuery = app->useRayQuery || useWavefront;
+    if (useRayQuery && !m_rayQuery)
+        throw std::runtime_error("The ray query backends (-q, -w) need VK_KHR_ray_query, which the device lacks!");
+    if (useWavefront) {
+        m_fixedSamples = true;
+        m_pcRay.samplesPerLaunch = 1; }
+
+    // With dynamic resolution the render size holds the frame time, so
+    // the sample count stays fixed and the screen is not tiled.
+    if (app->dynamicResolution) {
+        m_fixedSamples = true;
+        m_pcRay.samplesPerLaunch = std::max(app->samplesPerLaunch, 1); }
+
+    // Tiles are rounded up to whole workgroups of raytrace.comp.
+    useTiledDispatch = app->tileSize > 0 && !useWavefront && !app->dynamicResolution;
+    if (useTiledDispatch)
+        m_tileSize = (app->tileSize + 7) & ~7;
+
+    useAdaptiveSampling = app->convergenceThreshold > 0.0f;
+    m_convergenceThreshold = app->convergenceThreshold;
     
     // Requesting ray tracing properties
     VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
@@ -79,34 +124,35 @@ void VkApp::createRtDescriptorSet()
 {
   m_rtDesc.setBindings(m_device, {
           {0, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1,  // TLAS
-           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
-          {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,  // Col output image
-           VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-          {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,   // EmitterList aka. explicit lighting
-          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT},
-          {3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtColPrevBuffer
-          VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-          {4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtNdCurrBuffer
-          VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-          {5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtNdPrevBuffer
-          VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-          {6, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtKdCurrBuffer
-          VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-          {7, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtKdPrevBuffer
-          VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+          {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,   // EmitterList aka. explicit lighting
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+          {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,   // m_rtKdBuffer
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+          {3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,  // m_sampleMask
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+          {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,  // m_rayStatsBuff
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+          {5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,  // m_motionBuffer
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+          {6, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,  // m_visibilityBuffer
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
     });
     
 
-    // Note: This will grow to include more buffers.
+    // Note: This will grow to include more buffers.  The history
+    // pairs are in the bindless table.
 
-    m_rtDesc.write(m_device, 0, m_rtBuilder.getAccelerationStructure());
-    m_rtDesc.write(m_device, 1, m_rtColCurrBuffer.Descriptor());
-    m_rtDesc.write(m_device, 2, m_lightBuff.buffer);
-    m_rtDesc.write(m_device, 3, m_rtColPrevBuffer.Descriptor());
-    m_rtDesc.write(m_device, 4, m_rtNdCurrBuffer.Descriptor());
-    m_rtDesc.write(m_device, 5, m_rtNdPrevBuffer.Descriptor());
-    m_rtDesc.write(m_device, 6, m_rtKdCurrBuffer.Descriptor());
-    m_rtDesc.write(m_device, 7, m_rtKdPrevBuffer.Descriptor());
+    // Binding 0, the TLAS, is written once the acceleration structures
+    // are built, which the ray tracing pipelines need not wait for.
+    DescriptorBatch batch;
+    batch.write(m_rtDesc, 1, m_lightBuff.buffer);
+    batch.write(m_rtDesc, 2, m_rtKdBuffer.Descriptor());
+    batch.write(m_rtDesc, 3, m_sampleMask.Descriptor());
+    batch.write(m_rtDesc, 4, m_rayStatsBuff.buffer);
+    batch.write(m_rtDesc, 5, m_motionBuffer.Descriptor());
+    batch.write(m_rtDesc, 6, m_visibilityBuffer.Descriptor());
+    batch.flush(m_device);
 
 }
 
@@ -115,7 +161,7 @@ void VkApp::createRtDescriptorSet()
 void VkApp::createRtPipeline()
 {
     ////////////////////////////////////////////////////////////////////////////////////////////
-    // stages: Array of shaders: 1 raygen, 1 miss, 1 hit (later: an additional hit/miss pair.)
+    // stages: Array of shaders: 1 raygen, 2 miss (path and shadow rays), 1 hit
 
     ////////////////////////////////////////////////////////////////////////////////////////////
     // Group the shaders.  Raygen and miss shaders get their own
@@ -155,6 +201,16 @@ void VkApp::createRtPipeline()
     groups.push_back(group);
     group.generalShader    = VK_SHADER_UNUSED_KHR;
     
+    // Shadow miss shader (missIndex 1) stage and group appended to stages and groups lists
+    stage.module = createShaderModule(loadFile("spv/raytraceShadow.rmiss.spv"));
+    stage.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
+    stages.push_back(stage);
+    
+    group.type          = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+    group.generalShader = stages.size()-1;    // Index of shadow miss shader
+    groups.push_back(group);
+    group.generalShader    = VK_SHADER_UNUSED_KHR;
+    
     // Closest hit shader stage and group appended to stages and groups lists
     stage.module = createShaderModule(loadFile("spv/raytrace.rchit.spv"));
     stage.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
@@ -176,9 +232,10 @@ void VkApp::createRtPipeline()
     pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
     pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstant;
 
-    // Descriptor sets: one specific to ray tracing, and one shared with the rasterization pipeline
+    // Descriptor sets: one specific to ray tracing, one shared with the
+    // rasterization pipeline, and the bindless table
     std::vector<VkDescriptorSetLayout> rtDescSetLayouts =
-        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout};
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout, m_bindlessDesc.descSetLayout};
     pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(rtDescSetLayouts.size());
     pipelineLayoutCreateInfo.pSetLayouts = rtDescSetLayouts.data();
 
@@ -203,7 +260,9 @@ void VkApp::createRtPipeline()
     rayPipelineInfo.maxPipelineRayRecursionDepth = 10;  // Max ray recursion depth
     rayPipelineInfo.layout                       = m_rtPipelineLayout;
 
-    vkCreateRayTracingPipelinesKHR(m_device, {}, {}, 1, &rayPipelineInfo, nullptr, &m_rtPipeline);
+    double start = glfwGetTime();
+    vkCreateRayTracingPipelinesKHR(m_device, {}, m_pipelineCache, 1, &rayPipelineInfo, nullptr, &m_rtPipeline);
+    logPipelineTime("ray tracing", start);
     for (auto& s : stages)
         vkDestroyShaderModule(m_device, s.module, nullptr);
 
@@ -221,7 +280,7 @@ constexpr integral align_up(integral x, size_t a) noexcept
 
 void VkApp::createRtShaderBindingTable()
 {
-    uint32_t missCount{1};
+    uint32_t missCount{2};  // Path rays, shadow rays
     uint32_t hitCount{1};
 
     uint32_t handleCount = 1 + missCount + hitCount;
@@ -294,7 +353,7 @@ void VkApp::createRtShaderBindingTable()
     // Map the SBT buffer and write in the handles.
     uint8_t* mappedMemAddress;
     vkMapMemory(m_device, staging.memory, 0, sbtSize, 0, (void**)&mappedMemAddress);
-    uint8_t offset = 0;
+    VkDeviceSize offset = 0;
 
     // Raygen
     uint32_t handleIdx{0};
@@ -320,15 +379,19 @@ void VkApp::createRtShaderBindingTable()
 
 }
 
-void VkApp::CmdCopyImage(ImageWrap& src, ImageWrap& dst)
+// Copy src to dst, or only the extent at their origin if given.
+void VkApp::CmdCopyImage(ImageWrap& src, ImageWrap& dst, VkExtent2D extent)
 {
+    if (extent.width == 0)
+        extent = src.extent;
+
     VkImageCopy imageCopyRegion{};
     imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     imageCopyRegion.srcSubresource.layerCount = 1;
     imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     imageCopyRegion.dstSubresource.layerCount = 1;
-    imageCopyRegion.extent.width              = m_windowSize.width;
-    imageCopyRegion.extent.height             = m_windowSize.height;
+    imageCopyRegion.extent.width              = extent.width;
+    imageCopyRegion.extent.height             = extent.height;
     imageCopyRegion.extent.depth              = 1;
 
     imageLayoutBarrier(m_commandBuffer, src.image,
@@ -396,49 +459,221 @@ void VkApp::raytrace()
     m_pcRay.frameSeed = rand() % 32768;
     m_pcRay.rr = 0.7f; 
 
-    m_pcRay.depth = 1;
-    while (static_cast<float>(rand()) / RAND_MAX < m_pcRay.rr) {
-       m_pcRay.depth++;
-    }
-    m_pcRay.depth = std::min(m_pcRay.depth, 4);
-
-    m_pcRay.clear = app->myCamera.modified;
+    // Maximum path length.  Russian roulette picks each path's actual
+    // length in the shader, so the samples of one launch are independent.
+    m_pcRay.depth = 4;
+
+    updateSamplesPerLaunch();
+
+    // Ray cone texture LOD: the angle subtended by one pixel
+    m_pcRay.coneSpread = std::atan(2.0f * app->myCamera.ry / m_renderSize.height);
+
+    // Tiled dispatch: the screen is split into tiles of m_tileSize
+    // pixels, traced round-robin, m_tilesPerFrame of them per frame.
+    // Otherwise a single launch covers the whole screen.
+    int tileSize = useTiledDispatch ? m_tileSize : std::max(m_renderSize.width, m_renderSize.height);
+    int tilesX = (m_renderSize.width + tileSize - 1) / tileSize;
+    int tilesY = (m_renderSize.height + tileSize - 1) / tileSize;
+    int tileCount = tilesX * tilesY;
+    m_nextTile %= tileCount;
+
+    // After a camera move, every tile must be traced once with
+    // accumulation cleared, however many frames that takes.
+    // So must a change of render size.
+    if (app->myCamera.modified || m_renderSizeChanged) {
+        m_clearTiles = tileCount;
+        m_cameraMoves++; }
     app->myCamera.modified = false;
+    // A new tiling leaves no tile with a history of its own.
+    if (m_tileCamera.size() != size_t(tileCount) || (m_renderSizeChanged && useTiledDispatch))
+        m_tileCamera.assign(tileCount, -1);
+    m_pcRay.adaptive = useAdaptiveSampling;
+    m_pcRay.hybrid = app->hybridPrimary;
     m_pcRay.alignmentTest = 1234;
 
-    // Bind the ray tracing pipeline
-    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipeline);
+    // Adaptive sampling: once every pixel has converged, stop tracing
+    // and keep presenting the accumulated image until the camera moves.
+    bool converged = false;
+    if (useAdaptiveSampling) {
+        readAdaptiveStats();
+        converged = m_activePixels == 0 && m_clearTiles == 0; }
+
+    reportTraceRate();
+
+    // Bind the ray tracing pipeline, or the ray query backend's
+    // compute pipeline
+    VkPipelineBindPoint bindPoint = useRayQuery ? VK_PIPELINE_BIND_POINT_COMPUTE
+                                                : VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR;
+    VkPipelineLayout layout = useRayQuery ? m_rqPipelineLayout : m_rtPipelineLayout;
+    VkShaderStageFlags pcStages = useRayQuery ? VK_SHADER_STAGE_COMPUTE_BIT
+        : VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR;
+    vkCmdBindPipeline(m_commandBuffer, bindPoint, useRayQuery ? m_rqPipeline : m_rtPipeline);
 
     // Bind two descriptor sets (the ray tracing specific one, and the
     // full model descriptor)
-    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet};
-    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                            m_rtPipelineLayout, 0,
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet, m_bindlessDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, bindPoint, layout, 0,
                             descSets.size(), descSets.data(),
                             0, nullptr);
 
-    // Push the push constants
-    vkCmdPushConstants(m_commandBuffer, m_rtPipelineLayout,
-                       VK_SHADER_STAGE_RAYGEN_BIT_KHR
-                       | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
-                       | VK_SHADER_STAGE_MISS_BIT_KHR,
-                       0, sizeof(PushConstantRay), &m_pcRay);
-    m_pcRay.clear = false;  // Allow accumulation after at least one path tracing pass.
-
-    // This dispatches the ray generation shader for each pixel on screen.
-    vkCmdTraceRaysKHR(m_commandBuffer, &m_rgenRegion, &m_missRegion, &m_hitRegion,
-                      &m_callRegion, m_windowSize.width, m_windowSize.height, 1);
-    frameCount++;
-
-    
-    // Copy the ray tracer output image m_rtColCurrBuffer to
-    // m_renderTarget which feeds into the already completed
+    if (!converged) {
+        updateTilesPerFrame(tileCount);
+        m_tilesTraced = std::min(m_tilesPerFrame, tileCount);
+
+        vkCmdFillBuffer(m_commandBuffer, m_rayStatsBuff.buffer, 0, sizeof(RayStats), 0);
+        VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+        m_rayStatsPending = true;
+
+        // Last traced frame's histories become the previous ones:  an
+        // exchange of each pair's handles, not a copy.  Every pixel of
+        // this frame's images is then rewritten, by the trace and
+        // reproject.comp, or carried over from the previous ones.
+        std::swap(m_pcRay.colCurr, m_pcRay.colPrev);
+        std::swap(m_pcRay.ndCurr, m_pcRay.ndPrev);
+        std::swap(m_pcRay.momCurr, m_pcRay.momPrev);
+        m_pcRay.carry = false;
+
+        vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            m_timestampPool, TS_TRACE_BEGIN);
+
+        // Hybrid rendering:  the primary hits, rasterized for every tile
+        // at once, and timed as part of the trace.  Drawing rebinds the
+        // graphics state only, so the tracer's bindings stand.
+        if (m_pcRay.hybrid)
+            rasterizeVisibility();
+
+        std::vector<PushConstantRay> tiles;
+        for (int t = 0; t < m_tilesTraced; t++) {
+            int tile = m_nextTile;
+            m_nextTile = (m_nextTile + 1) % tileCount;
+            m_pcRay.tileX = (tile % tilesX) * tileSize;
+            m_pcRay.tileY = (tile / tilesX) * tileSize;
+            m_pcRay.clear = m_clearTiles > 0;
+            if (m_clearTiles > 0)
+                m_clearTiles--;
+            // The motion vectors lead back to last frame's camera;  a
+            // tile last traced before that has nothing to reproject.
+            m_pcRay.history = m_tileCamera[tile] == m_priorCamera;
+            m_tileCamera[tile] = m_cameraMoves;
+
+            // Push the push constants
+            vkCmdPushConstants(m_commandBuffer, layout, pcStages,
+                               0, sizeof(PushConstantRay), &m_pcRay);
+
+            // This dispatches the ray generation shader (or the ray
+            // query compute shader) for each pixel of the tile.
+            uint32_t width = std::min<uint32_t>(tileSize, m_renderSize.width - m_pcRay.tileX);
+            uint32_t height = std::min<uint32_t>(tileSize, m_renderSize.height - m_pcRay.tileY);
+            if (useWavefront)
+                wavefront();
+            else if (useRayQuery)
+                vkCmdDispatch(m_commandBuffer, (width + 7) / 8, (height + 7) / 8, 1);
+            else
+                vkCmdTraceRaysKHR(m_commandBuffer, &m_rgenRegion, &m_missRegion, &m_hitRegion,
+                                  &m_callRegion, width, height, 1);
+            tiles.push_back(m_pcRay); }
+        vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            m_timestampPool, TS_TRACE_END);
+
+        // The tiles left untraced, from m_nextTile on, keep their
+        // histories.
+        PushConstantRay carried = m_pcRay;
+        carried.carry = true;
+        for (int t = m_tilesTraced; t < tileCount; t++) {
+            int tile = (m_nextTile + t - m_tilesTraced) % tileCount;
+            carried.tileX = (tile % tilesX) * tileSize;
+            carried.tileY = (tile / tilesX) * tileSize;
+            tiles.push_back(carried); }
+
+        // Fold the new samples of the traced tiles into the history,
+        // and carry the others' over, timed apart from the trace, whose
+        // cost per sample or tile updateSamplesPerLaunch and
+        // updateTilesPerFrame measure.
+        reproject(tiles, tileSize);
+        vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            m_timestampPool, TS_REPROJECT_END);
+        frameCount++;
+
+        // The ray stats are read by the host after the frame's fence.
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(m_commandBuffer,
+                             VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        if (useAdaptiveSampling)
+            buildSampleMask(); }
+    m_priorCamera = m_cameraMoves;
+
+    // The color history, by handle m_pcRay.colCurr, is the ray
+    // tracer's output:  denoised, then resolved by the TAA pass (or
+    // the spatial upscaler) and sharpened into m_renderTarget, which
+    // feeds into the already completed
     // postProcess which then feeds into the swapchain for
     // display on the screen.
-    CmdCopyImage(m_rtColCurrBuffer, m_renderTarget);
-    
-    CmdCopyImage(m_rtColCurrBuffer, m_rtColPrevBuffer);
-    CmdCopyImage(m_rtNdCurrBuffer, m_rtNdPrevBuffer);
-    CmdCopyImage(m_rtKdCurrBuffer, m_rtKdPrevBuffer);
 }
 
+// Choose the number of samples per launch for the coming frame.  The
+// trace's cost per sample is measured by last frame's timestamps, and
+// the rest of the frame (denoise, post, ...) is taken as fixed
+// overhead, leaving the remainder of m_targetFrameMs for tracing.
+void VkApp::updateSamplesPerLaunch()
+{
+    // In tiled mode the tile count, not the sample count, holds the
+    // frame time.
+    if (m_fixedSamples || useTiledDispatch)
+        return;
+
+    float traceMs = timestampMs(TS_TRACE_BEGIN, TS_TRACE_END);
+    float frameMs = timestampMs(TS_FRAME_BEGIN, TS_FRAME_END);
+    if (traceMs <= 0.0f || frameMs <= 0.0f)
+        return;  // No measurement (first frame, or last frame was rasterized)
+
+    float msPerSample = traceMs / m_pcRay.samplesPerLaunch;
+    if (m_msPerSample == 0.0f)
+        m_msPerSample = msPerSample;
+    else
+        m_msPerSample = 0.9f*m_msPerSample + 0.1f*msPerSample;
+
+    float budgetMs = std::max(m_targetFrameMs - (frameMs - traceMs), 0.0f);
+    int samples = std::clamp(int(budgetMs / m_msPerSample), 1, m_maxSamplesPerLaunch);
+
+    if (samples != m_pcRay.samplesPerLaunch)
+        printf("Samples per launch: %d (%.2f ms/sample, %.2f ms frame)\n",
+               samples, m_msPerSample, frameMs);
+    m_pcRay.samplesPerLaunch = samples;
+}
+
+// Choose the number of tiles traced in the coming frame, from last
+// frame's trace cost per tile, in the same way as
+// updateSamplesPerLaunch.
+void VkApp::updateTilesPerFrame(int tileCount)
+{
+    if (!useTiledDispatch) {
+        m_tilesPerFrame = 1;
+        return; }
+
+    float traceMs = timestampMs(TS_TRACE_BEGIN, TS_TRACE_END);
+    float frameMs = timestampMs(TS_FRAME_BEGIN, TS_FRAME_END);
+    if (traceMs <= 0.0f || frameMs <= 0.0f || m_tilesTraced == 0)
+        return;  // No measurement
+
+    float msPerTile = traceMs / m_tilesTraced;
+    if (m_msPerTile == 0.0f)
+        m_msPerTile = msPerTile;
+    else
+        m_msPerTile = 0.9f*m_msPerTile + 0.1f*msPerTile;
+
+    float budgetMs = std::max(m_targetFrameMs - (frameMs - traceMs), 0.0f);
+    int tiles = std::clamp(int(budgetMs / m_msPerTile), 1, tileCount);
+
+    if (tiles != m_tilesPerFrame)
+        printf("Tiles per frame: %d of %d (%.2f ms/tile, %.2f ms frame)\n",
+               tiles, tileCount, m_msPerTile, frameMs);
+    m_tilesPerFrame = tiles;
+}
@@ -0,0 +1,166 @@
+//////////////////////////////////////////////////////////////////////
+// Parallel recording of the per-instance raster (-j N).  With many
+// instances, the push constants and binds of rasterize's draw loop
+// cost the main thread more than the GPU takes to draw them.  With N
+// recording threads, m_objInst is split into N contiguous ranges, and
+// each range is recorded by a persistent worker thread into its own
+// secondary command buffer, from its own command pool, which no other
+// thread touches.  The main thread then executes the secondaries
+// within m_scRenderPass.  With -j 1 (the default), the loop is
+// recorded inline into m_commandBuffer, as before.
+//
+// Only one frame is in flight (prepareFrame waits for its fence), so
+// each worker needs one secondary command buffer, and resets its pool
+// each frame.  rasterize's report gives the main thread's CPU time
+// per frame and the workers' recording time summed.
+////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+// Create a command pool and secondary command buffer per worker, and
+// start the workers, which wait for recordInstancesParallel.
+void VkApp::createRecordWorkers()
+{
+    int count = std::max(app->recordThreads, 1);
+    if (count == 1)
+        return;  // Recorded inline
+
+    m_recordWorkers.resize(count);
+    for (RecordWorker& worker : m_recordWorkers) {
+        VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+        poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolCreateInfo.queueFamilyIndex = m_graphicsQueueIndex;
+        if (vkCreateCommandPool(m_device, &poolCreateInfo, nullptr, &worker.pool) != VK_SUCCESS)
+            throw std::runtime_error("Failed to create a recording thread's command pool!");
+
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandPool        = worker.pool;
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        if (vkAllocateCommandBuffers(m_device, &allocateInfo, &worker.cmdBuf) != VK_SUCCESS)
+            throw std::runtime_error("Failed to allocate a secondary command buffer!"); }
+
+    // Started only once every worker's entry exists, as each refers
+    // to its own by index.
+    for (int i = 0; i < count; i++)
+        m_recordWorkers[i].thread = std::thread(&VkApp::recordWorker, this, i);
+    printf("Recording the raster on %d threads.\n", count);
+}
+
+void VkApp::destroyRecordWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_recordMutex);
+        m_recordQuit = true;
+    }
+    m_recordStart.notify_all();
+    for (RecordWorker& worker : m_recordWorkers) {
+        worker.thread.join();
+        vkDestroyCommandPool(m_device, worker.pool, nullptr); }  // Frees its command buffer
+    m_recordWorkers.clear();
+}
+
+// Record the draws of instances [first, end) of m_objInst, with the
+// forward raster's pipeline and descriptor set.
+void VkApp::recordInstanceDraws(VkCommandBuffer cmdBuf, size_t first, size_t end)
+{
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_scPipeline);
+    VkDescriptorSet sets[] = {m_scDesc.descSet, m_bindlessDesc.descSet};
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_scPipelineLayout, 0, 2, sets, 0, nullptr);
+
+    VkDeviceSize offset{0};
+    for (size_t i = first; i < end; i++) {
+        const ObjInst& inst = m_objInst[i];
+        auto& object = m_objData[inst.objIndex];
+        // Information pushed at each draw call
+        PushConstantRaster pcRaster{
+            scLightPos,
+            scLightInt,
+            scLightAmb,
+            inst.transform,      // Object's instance transform.
+            inst.objIndex       // instance Id
+        };
+
+        vkCmdPushConstants(cmdBuf, m_scPipelineLayout,
+                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(PushConstantRaster), &pcRaster);
+        vkCmdBindVertexBuffers(cmdBuf, 0, 1, &object.vertexBuffer.buffer, &offset);
+        vkCmdBindIndexBuffer(cmdBuf, object.indexBuffer.buffer, 0,
+                             VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexed(cmdBuf, object.nbIndices, 1, 0, 0, 0); }
+}
+
+// A worker's loop:  each time m_recordFrame advances, record its
+// range of the instances, then count itself done.
+void VkApp::recordWorker(int index)
+{
+    RecordWorker& worker = m_recordWorkers[index];
+    uint64_t frame = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_recordMutex);
+            m_recordStart.wait(lock, [&]() { return m_recordQuit || m_recordFrame != frame; });
+            if (m_recordQuit)
+                return;
+            frame = m_recordFrame;
+        }
+
+        double start = glfwGetTime();
+        size_t count = m_objInst.size();
+        size_t workers = m_recordWorkers.size();
+        vkResetCommandPool(m_device, worker.pool, 0);
+
+        VkCommandBufferInheritanceInfo inheritance{VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+        inheritance.renderPass  = m_scRenderPass;
+        inheritance.subpass     = 0;
+        inheritance.framebuffer = m_scFramebuffer;
+        VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+            | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritance;
+        vkBeginCommandBuffer(worker.cmdBuf, &beginInfo);
+        recordInstanceDraws(worker.cmdBuf, count * index / workers, count * (index + 1) / workers);
+        vkEndCommandBuffer(worker.cmdBuf);
+        worker.ms = (glfwGetTime() - start) * 1000.0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_recordMutex);
+            if (--m_recordPending == 0)
+                m_recordDone.notify_one();
+        }
+    }
+}
+
+// Record the instances' draws on the workers, and execute them within
+// the current m_scRenderPass, which must have been begun with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.  Returns the
+// workers' recording time, summed.
+double VkApp::recordInstancesParallel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_recordMutex);
+        m_recordPending = static_cast<int>(m_recordWorkers.size());
+        m_recordFrame++;
+    }
+    m_recordStart.notify_all();
+    {
+        std::unique_lock<std::mutex> lock(m_recordMutex);
+        m_recordDone.wait(lock, [this]() { return m_recordPending == 0; });
+    }
+
+    std::vector<VkCommandBuffer> cmdBufs;
+    double workerMs = 0.0;
+    for (const RecordWorker& worker : m_recordWorkers) {
+        cmdBufs.push_back(worker.cmdBuf);
+        workerMs += worker.ms; }
+    vkCmdExecuteCommands(m_commandBuffer, static_cast<uint32_t>(cmdBufs.size()), cmdBufs.data());
+    return workerMs;
+}
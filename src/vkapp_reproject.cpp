@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////
+// Motion vectors and temporal reprojection.  The path tracer writes
+// the new samples of each pixel, its G-buffer texels, and the screen
+// space motion of its first hit since the previous frame, found from
+// the camera's previous view-projection and the hit instance's
+// previous transform.  A separate compute pass (reproject.comp) then
+// follows the motion vector into last frame's history and blends.
+////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define GROUP_SIZE 8
+
+void VkApp::createMotionBuffers()
+{
+    VkImageUsageFlags flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    initImageWrap(m_motionBuffer, m_maxRenderSize, motionFormat, flags,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL);
+    NAME(m_motionBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_motionBuffer");
+
+    // Indexed by the instance custom index of the TLAS, which is the
+    // object index;  loadModel makes one instance per object, in order.
+    // It is uploaded with vkCmdUpdateBuffer, which takes at most 64KB.
+    VkDeviceSize size = m_objInst.size() * sizeof(glm::mat4);
+    if (size > 65536)
+        throw std::runtime_error("Too many instances for the instance motion buffer!");
+    initBufferWrap(m_instanceMotionBuff, size,
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    NAME(m_instanceMotionBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_instanceMotionBuff");
+
+    // Each instance's transform, likewise indexed, for the tracers to
+    // take a hit's object space normal and texel density to world
+    // space, and for deferred.comp to place the triangle.  Copied each
+    // frame from a mapped staging buffer, whatever its size.
+    initBufferWrap(m_instanceTransformBuff, size,
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    NAME(m_instanceTransformBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_instanceTransformBuff");
+    initBufferWrap(m_instanceTransformStaging, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_instanceTransformStaging.buffer, VK_OBJECT_TYPE_BUFFER, "m_instanceTransformStaging");
+    vkMapMemory(m_device, m_instanceTransformStaging.memory, 0, size, 0,
+                (void**)&m_instanceTransforms);
+}
+
+// Upload each instance's motion since the previous frame, as the
+// matrix taking this frame's world positions on the instance to last
+// frame's, in the manner of updateCameraBuffer.  Instances only move
+// if something changes their ObjInst::transform (and rebuilds the
+// TLAS to match).
+void VkApp::updateInstanceMotion()
+{
+    std::vector<glm::mat4> motion;
+    motion.reserve(m_objInst.size());
+    for (ObjInst& inst : m_objInst) {
+        motion.push_back(inst.prevTransform * glm::inverse(inst.transform));
+        inst.prevTransform = inst.transform; }
+
+    VkDeviceSize size = motion.size() * sizeof(glm::mat4);
+    auto usageStages = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    // Ensure that the modified buffer is not visible to previous frames.
+    VkBufferMemoryBarrier beforeBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    beforeBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    beforeBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    beforeBarrier.buffer        = m_instanceMotionBuff.buffer;
+    beforeBarrier.size          = size;
+    vkCmdPipelineBarrier(m_commandBuffer, usageStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 1, &beforeBarrier, 0, nullptr);
+
+    vkCmdUpdateBuffer(m_commandBuffer, m_instanceMotionBuff.buffer, 0, size, motion.data());
+
+    // Making sure the updated buffer will be visible.
+    VkBufferMemoryBarrier afterBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    afterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    afterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    afterBarrier.buffer        = m_instanceMotionBuff.buffer;
+    afterBarrier.size          = size;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, usageStages, 0,
+                         0, nullptr, 1, &afterBarrier, 0, nullptr);
+}
+
+// Upload each instance's transform through the staging buffer.  The
+// last frame's fence has signaled (prepareFrame), so its copy is done
+// with the staging buffer.
+void VkApp::updateInstanceTransforms()
+{
+    for (size_t i = 0;  i < m_objInst.size();  i++)
+        m_instanceTransforms[i] = m_objInst[i].transform;
+    VkDeviceSize size = m_objInst.size() * sizeof(glm::mat4);
+
+    VkBufferMemoryBarrier barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.buffer        = m_instanceTransformBuff.buffer;
+    barrier.size          = size;
+    auto usageStages = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, usageStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+
+    VkBufferCopy region{0, 0, size};
+    vkCmdCopyBuffer(m_commandBuffer, m_instanceTransformStaging.buffer,
+                    m_instanceTransformBuff.buffer, 1, &region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, usageStages, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void VkApp::createReprojectPipeline()
+{
+    // The ray tracing descriptor set and push constants, for the
+    // images, tile, and flags of the trace.
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantRay)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.setLayoutCount = 1;
+    plCreateInfo.pSetLayouts = &m_rtDesc.descSetLayout;
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_reprojectPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_reprojectPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/reproject.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    double start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_reprojectPipeline);
+    logPipelineTime("reproject", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+// Record the reprojection pass over the tiles just traced, each with
+// the push constants it was traced with.
+void VkApp::reproject(const std::vector<PushConstantRay>& tiles, int tileSize)
+{
+    // Wait for the tracer's new samples, G-buffer texels and motion vectors.
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_reprojectPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_reprojectPipelineLayout, 0, 1, &m_rtDesc.descSet, 0, nullptr);
+
+    // Tiles do not overlap, so need no barriers between them.
+    for (const PushConstantRay& tile : tiles) {
+        vkCmdPushConstants(m_commandBuffer, m_reprojectPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(PushConstantRay), &tile);
+        uint32_t width = std::min<uint32_t>(tileSize, m_renderSize.width - tile.tileX);
+        uint32_t height = std::min<uint32_t>(tileSize, m_renderSize.height - tile.tileY);
+        // This MUST match the shader's GROUP_SIZE
+        vkCmdDispatch(m_commandBuffer, (width + GROUP_SIZE - 1) / GROUP_SIZE,
+                      (height + GROUP_SIZE - 1) / GROUP_SIZE, 1); }
+}
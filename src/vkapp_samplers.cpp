@@ -0,0 +1,77 @@
+//////////////////////////////////////////////////////////////////////
+// The sampler cache.  Samplers depend only on their SamplerKey, not
+// on the images they sample, so every image with the same key shares
+// one VkSampler:  all of the model's textures and the render target
+// share a single sampler, however many textures a scene has, instead
+// of each creating its own against maxSamplerAllocationCount.
+//
+// Each sampler counts the images holding it.  releaseSampler, called
+// before an image is destroyed (ImageWrap::destroy leaves its sampler
+// alone), destroys the sampler with its last image;  destroySamplers
+// destroys any left at teardown.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <string>
+
+#include "vkapp.h"
+
+#include "app.h"
+
+VkSampler VkApp::acquireSampler(const SamplerKey& key)
+{
+    auto found = m_samplers.find(key);
+    if (found != m_samplers.end()) {
+        found->second.refs++;
+        return found->second.sampler; }
+
+    // Anisotropy is clamped to what the device allows, as queried once
+    // by createPhysicalDevice.
+    VkSamplerCreateInfo samplerInfo{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter = key.filter;
+    samplerInfo.minFilter = key.filter;
+    samplerInfo.mipmapMode = key.mipmapMode;
+    samplerInfo.addressModeU = key.addressMode;
+    samplerInfo.addressModeV = key.addressMode;
+    samplerInfo.addressModeW = key.addressMode;
+    samplerInfo.anisotropyEnable = key.maxAnisotropy > 0.0f;
+    samplerInfo.maxAnisotropy = std::min(key.maxAnisotropy,
+                                         m_deviceProperties.limits.maxSamplerAnisotropy);
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.minLod = key.minLod;
+    samplerInfo.maxLod = key.maxLod;
+
+    if (m_samplers.size() >= m_deviceProperties.limits.maxSamplerAllocationCount)
+        throw std::runtime_error("Too many distinct samplers for the device!");
+    VkSampler sampler;
+    if (vkCreateSampler(m_device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a sampler!");
+    m_samplers[key] = SharedSampler{sampler, 1};
+    return sampler;
+}
+
+// Release the image's sampler, if it has one, and destroy the sampler
+// if no other image holds it.
+void VkApp::releaseSampler(ImageWrap& wrap)
+{
+    if (wrap.sampler == VK_NULL_HANDLE)
+        return;
+    for (auto it = m_samplers.begin(); it != m_samplers.end(); ++it) {
+        if (it->second.sampler != wrap.sampler)
+            continue;
+        if (--it->second.refs == 0) {
+            vkDestroySampler(m_device, it->second.sampler, nullptr);
+            m_samplers.erase(it); }
+        break; }
+    wrap.sampler = VK_NULL_HANDLE;
+}
+
+void VkApp::destroySamplers()
+{
+    for (auto& [key, shared] : m_samplers)
+        vkDestroySampler(m_device, shared.sampler, nullptr);
+    m_samplers.clear();
+}
@@ -22,7 +22,7 @@ using namespace glm;
 
 void VkApp::createRenderTarget()
 {
-    VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    VkFormat format = colorFormat;
     VkImageUsageFlags flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
     VkMemoryPropertyFlags mem = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -39,7 +39,7 @@ void VkApp::createPostDescriptor()
             {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT}
         });
     
-    m_postDesc.write(m_device, 0, m_renderTarget.Descriptor());
+    m_postDesc.write(m_device, 0, m_displayBuffer.Descriptor());  // See vkapp_tonemap.cpp
 
 }
 
@@ -71,7 +71,7 @@ void VkApp::createObjDescriptionBuffer()
 void VkApp::createScRenderPass()
 {
     VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    colorAttachment.format = colorFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
@@ -84,11 +84,11 @@ void VkApp::createScRenderPass()
     depthAttachment.format =  VK_FORMAT_X8_D24_UNORM_PACK32;
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;  // For the depth pyramid
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
     
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -115,17 +115,39 @@ void VkApp::createScRenderPass()
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
         | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     
+    // The depth and color are read by compute passes after:  the depth
+    // pyramid, and tone mapping.
+    VkSubpassDependency after{};
+    after.srcSubpass = 0;
+    after.dstSubpass = VK_SUBPASS_EXTERNAL;
+    after.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    after.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    after.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    after.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    std::array<VkSubpassDependency, 2> dependencies = {dependency, after};
     std::array<VkAttachmentDescription, 2> attachmentsDsc = {colorAttachment, depthAttachment};
     VkRenderPassCreateInfo renderPassInfo{VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
     renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentsDsc.size());
     renderPassInfo.pAttachments = attachmentsDsc.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
     
     vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_scRenderPass);
 
+    // The occlusion culling's second pass, which draws over the first's
+    // color and depth, after the depth pyramid has read the depth.
+    // Compatible with m_scRenderPass, so uses the same framebuffer.
+    attachmentsDsc[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachmentsDsc[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachmentsDsc[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_scLateRenderPass);
+
     std::vector<VkImageView> attachments = {m_renderTarget.imageView, m_depthImage.imageView};
 
     VkFramebufferCreateInfo info{VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
@@ -141,24 +163,32 @@ void VkApp::createScRenderPass()
 
 void VkApp::createScDescriptorSet()
 {
-    auto nbTxt = static_cast<uint32_t>(m_objText.size());
-
     // This descriptor set is being created for both the scanline and
-    // raytracing pipelines; Note the mention of VERTEX, FRAGMENT, and
-    // RAYGEN shader stages.
+    // raytracing pipelines; Note the mention of VERTEX, FRAGMENT,
+    // RAYGEN, and COMPUTE (the ray query backend) shader stages, and
+    // MESH (the meshlet raster) where supported.
+    // Bindings 2 and 3 are the per instance motion and transform of
+    // createMotionBuffers.  The textures are in the bindless table.
+    VkShaderStageFlags meshStage = m_meshShader ? VK_SHADER_STAGE_MESH_BIT_EXT : 0;
     m_scDesc.setBindings(m_device, {
             {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
-                VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+                VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR
+                | VK_SHADER_STAGE_COMPUTE_BIT | meshStage},
             {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
-                | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
-            {2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nbTxt,
-                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR}
+                | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT | meshStage},
+            {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT}
         });
               
-    m_scDesc.write(m_device, 0, m_matrixBuff.buffer);
-    m_scDesc.write(m_device, 1, m_objDescriptionBuff.buffer);
-    m_scDesc.write(m_device, 2, m_objText);    
+    DescriptorBatch batch;
+    batch.write(m_scDesc, 0, m_matrixBuff.buffer);
+    batch.write(m_scDesc, 1, m_objDescriptionBuff.buffer);
+    batch.write(m_scDesc, 2, m_instanceMotionBuff.buffer);
+    batch.write(m_scDesc, 3, m_instanceTransformBuff.buffer);
+    batch.flush(m_device);
 
 }
 
@@ -167,10 +197,13 @@ void VkApp::createScPipeline()
     VkPushConstantRange pushConstantRanges = {
         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantRaster)};
 
-    // Creating the Pipeline Layout
+    // Creating the Pipeline Layout:  the model's set, and the bindless
+    // table for scanline.frag's textures
+    std::vector<VkDescriptorSetLayout> setLayouts =
+        {m_scDesc.descSetLayout, m_bindlessDesc.descSetLayout};
     VkPipelineLayoutCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
-    createInfo.setLayoutCount         = 1;
-    createInfo.pSetLayouts            = &m_scDesc.descSetLayout;
+    createInfo.setLayoutCount         = static_cast<uint32_t>(setLayouts.size());
+    createInfo.pSetLayouts            = setLayouts.data();
     createInfo.pushConstantRangeCount = 1;
     createInfo.pPushConstantRanges    = &pushConstantRanges;
     if (vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_scPipelineLayout) != VK_SUCCESS) {
@@ -288,11 +321,78 @@ void VkApp::createScPipeline()
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_scPipeline) != VK_SUCCESS) {
+    double start = glfwGetTime();
+    if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_scPipeline) != VK_SUCCESS) {
       throw std::runtime_error("Failed to create graphics pipeline!");
     }
+    logPipelineTime("scanline", start);
     printf("Graphics pipeline created successfully.\n");
 
+    // The GPU-driven raster's variant (see vkapp_cull.cpp):  the same
+    // but for scanlineIndirect.vert, which reads each draw's instance
+    // from set 2 and fetches its own vertices, and for back-face
+    // culling, set per CullList.
+    std::vector<VkDescriptorSetLayout> indirectSetLayouts =
+        {m_scDesc.descSetLayout, m_bindlessDesc.descSetLayout, m_cullMeshes.desc.descSetLayout};
+    createInfo.setLayoutCount = static_cast<uint32_t>(indirectSetLayouts.size());
+    createInfo.pSetLayouts    = indirectSetLayouts.data();
+    if (vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_scIndirectPipelineLayout) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create pipeline layout!");
+    }
+
+    VkShaderModule indirectShaderModule = createShaderModule(loadFile("spv/scanlineIndirect.vert.spv"));
+    shaderStages[0].module = indirectShaderModule;
+    pipelineInfo.layout = m_scIndirectPipelineLayout;
+    VkPipelineVertexInputStateCreateInfo
+        noVertexInput{VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+    pipelineInfo.pVertexInputState = &noVertexInput;
+
+    VkDynamicState cullModeState = VK_DYNAMIC_STATE_CULL_MODE;
+    VkPipelineDynamicStateCreateInfo dynamicState{VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+    dynamicState.dynamicStateCount = 1;
+    dynamicState.pDynamicStates = &cullModeState;
+    pipelineInfo.pDynamicState = &dynamicState;
+
+    start = glfwGetTime();
+    if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_scIndirectPipeline) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create graphics pipeline!");
+    }
+    logPipelineTime("scanline indirect", start);
+    vkDestroyShaderModule(m_device, indirectShaderModule, nullptr);
+
+    // The meshlet raster's (see vkapp_cull.cpp):  meshlet.task and
+    // meshlet.mesh in place of the vertex input and shader, with
+    // back-face culling.  The push constants are PushConstantMeshlet,
+    // but must also hold scanline.frag's PushConstantRaster.
+    if (m_meshShader) {
+        VkPushConstantRange meshletPushConstantRange{
+            VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            0, static_cast<uint32_t>(std::max(sizeof(PushConstantMeshlet), sizeof(PushConstantRaster)))};
+        createInfo.pPushConstantRanges = &meshletPushConstantRange;
+        if (vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_meshletPipelineLayout) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create pipeline layout!");
+        }
+
+        VkPipelineShaderStageCreateInfo meshletStages[3] = {
+            createShaderStageInfo(loadFile("spv/meshlet.task.spv"), VK_SHADER_STAGE_TASK_BIT_EXT),
+            createShaderStageInfo(loadFile("spv/meshlet.mesh.spv"), VK_SHADER_STAGE_MESH_BIT_EXT),
+            shaderStages[1]};
+        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+        pipelineInfo.stageCount = 3;
+        pipelineInfo.pStages = meshletStages;
+        pipelineInfo.pVertexInputState = nullptr;
+        pipelineInfo.pInputAssemblyState = nullptr;
+        pipelineInfo.pDynamicState = nullptr;
+        pipelineInfo.layout = m_meshletPipelineLayout;
+
+        start = glfwGetTime();
+        if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_meshletPipeline) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create graphics pipeline!");
+        }
+        logPipelineTime("meshlet", start);
+        vkDestroyShaderModule(m_device, meshletStages[0].module, nullptr);
+        vkDestroyShaderModule(m_device, meshletStages[1].module, nullptr); }
+
     // Done with the temporary spv shader modules.
     vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
     vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
@@ -301,8 +401,27 @@ void VkApp::createScPipeline()
 
 void VkApp::rasterize()
 {
-    VkDeviceSize offset{0};
-    
+    double recordStart = glfwGetTime();
+    bool gpuDriven = app->gpuDrivenRaster && m_drawIndirectCount;
+    bool occlusion = gpuDriven && app->occlusionCulling && m_hizSupported;
+    bool meshlets = gpuDriven && app->meshletRaster;
+    bool meshShader = meshlets && app->meshShaders && m_meshShader;
+    CullList& list = meshlets ? m_cullMeshlets : m_cullMeshes;
+    uint32_t firstPhase = occlusion ? CULL_EARLY : CULL_FRUSTUM;
+    readCullStats();  // Last frame's
+    if (gpuDriven) {
+        beginCull(list);
+        if (!meshShader)  // Else culled as drawn
+            cull(list, firstPhase); }
+    else if (app->deferredRaster) {
+        rasterizeDeferred();
+        reportRaster("deferred, per-instance ID draws", nullptr, (glfwGetTime() - recordStart) * 1000.0);
+        return; }
+
+    // The per-instance loop may be recorded on the recording threads,
+    // into secondary command buffers;  see vkapp_recording.cpp.
+    bool parallel = !gpuDriven && !m_recordWorkers.empty();
+
     std::array<VkClearValue, 2> clearValues{};
     clearValues[0].color        = {{0,0,0,1}};
     clearValues[1].depthStencil = {1.0f, 0};
@@ -313,35 +432,44 @@ void VkApp::rasterize()
     beginInfo.renderPass      = m_scRenderPass;
     beginInfo.framebuffer     = m_scFramebuffer;
     beginInfo.renderArea      = {{0, 0}, m_windowSize};
-    vkCmdBeginRenderPass(m_commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_scPipeline);
-    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_scPipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
-
-    for(const ObjInst& inst : m_objInst) {
-        auto& object            = m_objData[inst.objIndex];
-        // Information pushed at each draw call
-        PushConstantRaster pcRaster{
-            scLightPos,
-            scLightInt,
-            scLightAmb,
-            inst.transform,      // Object's instance transform.
-            inst.objIndex       // instance Id
-        };
-        
-        pcRaster.objIndex    = inst.objIndex;  // Telling which object is drawn
-        pcRaster.modelMatrix = inst.transform;
-
-        vkCmdPushConstants(m_commandBuffer, m_scPipelineLayout,
-                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
-                           sizeof(PushConstantRaster), &pcRaster);
-        vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, &object.vertexBuffer.buffer, &offset);
-        vkCmdBindIndexBuffer(m_commandBuffer, object.indexBuffer.buffer, 0,
-                             VK_INDEX_TYPE_UINT32);
-        vkCmdDrawIndexed(m_commandBuffer, object.nbIndices, 1, 0, 0, 0); }
+    vkCmdBeginRenderPass(m_commandBuffer, &beginInfo, parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                                               : VK_SUBPASS_CONTENTS_INLINE);
+
+    if (gpuDriven) {
+        drawCulled(list, firstPhase, meshShader);
+        vkCmdEndRenderPass(m_commandBuffer);
+
+        // Two-phase occlusion culling:  the depth of what was visible
+        // last frame, drawn above, occludes the rest.  Whatever is newly
+        // visible is drawn over it.
+        if (occlusion) {
+            buildHiz();
+            if (!meshShader)
+                cull(list, CULL_LATE);
+            beginInfo.renderPass = m_scLateRenderPass;  // Loads, rather than clears
+            vkCmdBeginRenderPass(m_commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            drawCulled(list, CULL_LATE, meshShader);
+            vkCmdEndRenderPass(m_commandBuffer); }
+        endCull();
+
+        std::string mode = std::string("GPU-driven ") + list.name;
+        if (meshShader)
+            mode += ", mesh shaders";
+        if (occlusion)
+            mode += ", occlusion culled";
+        reportRaster(mode, &list, (glfwGetTime() - recordStart) * 1000.0);
+        return; }
+
+    double workerMs = 0.0;
+    std::string mode = "per-instance draws";
+    if (parallel) {
+        workerMs = recordInstancesParallel();
+        mode += ", " + std::to_string(m_recordWorkers.size()) + " recording threads"; }
+    else
+        recordInstanceDraws(m_commandBuffer, 0, m_objInst.size());
     
     vkCmdEndRenderPass(m_commandBuffer);
+    reportRaster(mode, nullptr, (glfwGetTime() - recordStart) * 1000.0, workerMs);
 }
 
 
@@ -352,17 +480,29 @@ void VkApp::updateCameraBuffer()
     glm::mat4    view = app->myCamera.view(glfwGetTime());
     glm::mat4    proj = app->myCamera.perspective(aspectRatio);
   
+    // Sub-pixel jitter for the TAA pass, in render pixels, moving the
+    // pixel's sample point by +jitter.  The rasterizer has no TAA, so
+    // is not jittered.  The prior matrix is kept unjittered, for
+    // motion vectors.
+    glm::vec2 jitter = useRaytracer ? taaJitter() : glm::vec2(0.0f);
+    glm::mat4 jitteredProj = glm::translate(glm::mat4(1.0f),
+        glm::vec3(-2.0f * jitter.x / m_renderSize.width, -2.0f * jitter.y / m_renderSize.height, 0.0f)) * proj;
+  
     MatrixUniforms hostUBO;
     hostUBO.priorViewProj = m_priorViewProj;
-    hostUBO.viewProj    = proj * view;
-    m_priorViewProj       = hostUBO.viewProj;
+    hostUBO.viewProj    = jitteredProj * view;
+    m_priorViewProj       = proj * view;
     hostUBO.viewInverse = glm::inverse(view);
-    hostUBO.projInverse = glm::inverse(proj);
+    hostUBO.projInverse = glm::inverse(jitteredProj);
+    hostUBO.jitter      = glm::vec4(jitter, 0.0f, 0.0f);
 
     // UBO on the device, and what stages access it.
     VkBuffer deviceUBO      = m_matrixBuff.buffer;
-    auto     uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
-                            | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+    VkPipelineStageFlags uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+                            | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                            | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (m_meshShader)
+        uboUsageStages |= VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT;
 
     // Ensure that the modified UBO is not visible to previous frames.
     VkBufferMemoryBarrier beforeBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
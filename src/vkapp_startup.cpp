@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////////
+// Startup task graph.  The constructor runs the work that records or
+// submits commands (model loading, texture uploads, acceleration
+// structure builds) on the main thread, which owns m_cmdPool and
+// m_queue, and hands each pipeline's descriptor set and pipeline
+// creation to a worker thread with startupTask.  A task is started
+// only once the images and buffers its descriptor set refers to
+// exist;  the tasks themselves touch no command pool or queue, and
+// share only the internally synchronized m_pipelineCache.
+// joinStartupTasks waits for all of them before the first frame.
+//
+// Meanwhile preloadShaders reads every spv/ file in the background,
+// and loadFile takes a preloaded file when there is one.
+//
+// startupPhase marks the end of each main thread phase, and
+// reportStartup prints the phases and the tasks' times.
+////////////////////////////////////////////////////////////////////////
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+
+namespace fs = std::filesystem;
+
+// Read a file's bytes into a string
+static std::string readFile(const std::string& filename)
+{
+    std::string   result;
+    std::ifstream stream(filename, std::ios::ate | std::ios::binary);  //ate: Open at file end
+
+    if(!stream.is_open())
+        throw std::runtime_error("Can not open a shader file.\n");
+
+    result.reserve(stream.tellg()); // tellg() is last char position in file (i.e.,  length)
+
+    // Seek back to the beginning of the file and read it's contents
+    stream.seekg(0, std::ios::beg);
+    result.assign((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    return result;
+}
+
+// Start reading every compiled shader in the background.
+void VkApp::preloadShaders()
+{
+    m_startupBegin = m_phaseBegin = glfwGetTime();
+
+    std::error_code error;
+    std::lock_guard<std::mutex> lock(m_shaderFilesMutex);
+    for (const auto& entry : fs::directory_iterator("spv", error)) {
+        if (entry.path().extension() != ".spv")
+            continue;
+        std::string filename = "spv/" + entry.path().filename().string();
+        m_shaderFiles[filename] = std::async(std::launch::async, readFile, filename); }
+}
+
+// A file's bytes, preloaded if preloadShaders got to it.  Safe to call
+// from startup tasks.
+std::string VkApp::loadFile(const std::string& filename)
+{
+    std::future<std::string> preloaded;
+    {
+        std::lock_guard<std::mutex> lock(m_shaderFilesMutex);
+        auto it = m_shaderFiles.find(filename);
+        if (it != m_shaderFiles.end()) {
+            preloaded = std::move(it->second);
+            m_shaderFiles.erase(it); }
+    }
+    if (preloaded.valid())
+        return preloaded.get();
+    return readFile(filename);
+}
+
+// Run work on a worker thread, timed.
+void VkApp::startupTask(const char* name, std::function<void()> work)
+{
+    m_startupTasks.push_back({name, std::async(std::launch::async, [work]() {
+        double start = glfwGetTime();
+        work();
+        return float(glfwGetTime() - start) * 1000.0f; })});
+}
+
+// Wait for every startup task;  a task's exception is rethrown here.
+void VkApp::joinStartupTasks()
+{
+    for (StartupTask& task : m_startupTasks)
+        m_startupTaskMs.push_back({task.name, task.done.get()});
+    m_startupTasks.clear();
+    startupPhase("wait for pipelines");
+
+    // Any preloaded file nothing asked for
+    std::lock_guard<std::mutex> lock(m_shaderFilesMutex);
+    m_shaderFiles.clear();
+}
+
+// Record the time since the last phase ended as the named phase's.
+void VkApp::startupPhase(const char* name)
+{
+    double now = glfwGetTime();
+    m_startupPhaseMs.push_back({name, float(now - m_phaseBegin) * 1000.0f});
+    m_phaseBegin = now;
+}
+
+void VkApp::reportStartup()
+{
+    printf("Startup: %.1f ms\n", float(glfwGetTime() - m_startupBegin) * 1000.0f);
+    for (const auto& phase : m_startupPhaseMs)
+        printf("  %-26s %8.1f ms\n", phase.first.c_str(), phase.second);
+    printf("  Worker tasks, concurrent with the above:\n");
+    for (const auto& task : m_startupTaskMs)
+        printf("    %-24s %8.1f ms\n", task.first.c_str(), task.second);
+}
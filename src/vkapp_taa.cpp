@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////
+// Temporal anti-aliasing and upsampling.  The path tracer and the
+// denoiser run at m_renderSize, a fraction (app->renderScale, -r) of
+// the window size.  Each frame updateCameraBuffer jitters the camera
+// by a sub-pixel offset from a Halton sequence, and taa.comp resolves
+// the denoised image into m_upscaleBuffer at the window size, blending
+// with its reprojected and clamped history;  sharpen() then writes
+// m_renderTarget (see vkapp_upscale.cpp).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define GROUP_SIZE 8
+
+// Radical inverse of i in the given base
+static float halton(int i, int base)
+{
+    float f = 1.0f;
+    float r = 0.0f;
+    while (i > 0) {
+        f /= base;
+        r += f * (i % base);
+        i /= base; }
+    return r;
+}
+
+void VkApp::createTaaBuffers()
+{
+    VkImageUsageFlags flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    initImageWrap(m_taaHistory, m_windowSize, colorFormat, flags,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL);
+    NAME(m_taaHistory.image, VK_OBJECT_TYPE_IMAGE, "m_taaHistory");
+
+    // The first frame resolves into m_upscaleBuffer (see taa)
+    m_pcTaa.historyImage = bindlessStorageImage(m_taaHistory);
+    m_pcTaa.outImage = m_upscaleHandle;
+}
+
+void VkApp::createTaaDescriptorSet()
+{
+    m_taaDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+
+    // The denoised image, the history and the output are read by the
+    // handles in m_pcTaa.
+    m_taaDesc.write(m_device, 0, m_motionBuffer.Descriptor());  // The motion vectors
+}
+
+void VkApp::createTaaPipeline()
+{
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantTaa)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    std::vector<VkDescriptorSetLayout> setLayouts = {m_taaDesc.descSetLayout,
+                                                     m_bindlessDesc.descSetLayout};
+    plCreateInfo.setLayoutCount = (uint32_t)setLayouts.size();
+    plCreateInfo.pSetLayouts = setLayouts.data();
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_taaPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_taaPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/taa.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    double start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_taaPipeline);
+    logPipelineTime("taa", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+// This frame's camera jitter, in render pixels within [-0.5, 0.5).
+// The Halton (2, 3) sequence covers a pixel evenly in few frames;  with
+// upsampling, each output pixel is a fraction of a render pixel, so
+// the sequence is lengthened to cover it as well.
+glm::vec2 VkApp::taaJitter()
+{
+    int phases = std::clamp(int(8.0f / (m_renderScale * m_renderScale)), 8, 64);
+    int k = (m_taaFrame++ % phases) + 1;
+    m_pcTaa.jitter = glm::vec2(halton(k, 2), halton(k, 3)) - glm::vec2(0.5f);
+    return m_pcTaa.jitter;
+}
+
+// Resolve the denoiser's output (at the render size) into one of
+// m_upscaleBuffer and m_taaHistory, reading the other as the history,
+// and swap their handles so the result is next frame's history.
+void VkApp::taa()
+{
+    m_pcTaa.blend = 0.1f;
+    m_pcTaa.reset = m_taaReset;
+    m_pcTaa.inImage = m_denoiseOutput;
+    m_taaReset = false;
+
+    // Wait for the denoiser's output
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_taaPipeline);
+    VkDescriptorSet sets[] = {m_taaDesc.descSet, m_bindlessDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_taaPipelineLayout, 0, 2, sets, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_taaPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantTaa), &m_pcTaa);
+    // This MUST match the shader's GROUP_SIZE
+    vkCmdDispatch(m_commandBuffer, (m_windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  (m_windowSize.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+
+    // sharpen reads this frame's output, and next frame resolves into
+    // the image just read as the history.
+    m_upscaleOutput = m_pcTaa.outImage;
+    std::swap(m_pcTaa.outImage, m_pcTaa.historyImage);
+}
@@ -0,0 +1,173 @@
+//////////////////////////////////////////////////////////////////////
+// The texture registry.  Materials often share an image (San Miguel's
+// reference the same few files from many materials, under paths that
+// differ in their separators and "..").  loadTextures canonicalizes
+// each path and loads the file only the first time it is seen;  every
+// later reference shares its m_objText entry, without reading,
+// uploading, or mipmapping it again.
+//
+// The files are decoded on worker threads, a few ahead of the main
+// thread, which uploads each in turn (it owns m_cmdPool and m_queue).
+//
+// With -C, files are also identified by their contents (size and a
+// 64-bit FNV-1a hash), which catches copies of an image under
+// different names.  A file is read once, both to hash and to decode;
+// one that matches an earlier file's key shares its entry only if
+// their bytes are equal.  reportTextures gives the counts and the
+// device memory the shared references did not take.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "stb_image.h"
+
+namespace fs = std::filesystem;
+
+// Forward slashes (the models' files may have been written on
+// Windows), then resolved against the file system as far as it exists.
+static std::string canonicalTexturePath(std::string path)
+{
+    for (char& c : path)
+        if (c == '\\') c = '/';
+    std::error_code error;
+    fs::path canonical = fs::weakly_canonical(fs::path(path), error);
+    if (error)
+        canonical = fs::path(path).lexically_normal();
+    return canonical.generic_u8string();
+}
+
+// A file's bytes;  none if it cannot be read.
+static std::vector<unsigned char> readBytes(const std::string& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    return std::vector<unsigned char>((std::istreambuf_iterator<char>(stream)),
+                                      std::istreambuf_iterator<char>());
+}
+
+// Size and hash of a file's bytes;  {0, 0} if there are none.
+static std::pair<uint64_t, uint64_t> contentKey(const std::vector<unsigned char>& bytes)
+{
+    if (bytes.empty())
+        return {0, 0};
+    uint64_t hash = 0xcbf29ce484222325ull;  // FNV-1a
+    for (unsigned char byte : bytes) {
+        hash ^= byte;
+        hash *= 0x100000001b3ull; }
+    return {bytes.size(), hash};
+}
+
+// Device memory of an RGBA8 texture with its full mip chain
+static VkDeviceSize textureBytes(VkExtent2D extent)
+{
+    VkDeviceSize bytes = 0;
+    uint32_t width = extent.width, height = extent.height;
+    while (true) {
+        bytes += VkDeviceSize(width) * height * 4;
+        if (width == 1 && height == 1)
+            return bytes;
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u); }
+}
+
+// Read and decode a texture file;  run on a worker thread.
+static VkApp::DecodedTexture decodeTexture(const std::string& path, bool hash)
+{
+    VkApp::DecodedTexture texture;
+    texture.path = path;
+    std::vector<unsigned char> bytes = readBytes(path);
+    int channels;
+    stbi_uc* pixels = stbi_load_from_memory(bytes.data(), int(bytes.size()),
+                                            &texture.width, &texture.height, &channels,
+                                            STBI_rgb_alpha);
+    if (!pixels)
+        throw std::runtime_error("failed to load texture image!");
+    texture.pixels = std::shared_ptr<unsigned char>(pixels, stbi_image_free);
+    if (hash) {
+        texture.content = contentKey(bytes);
+        texture.bytes = std::move(bytes); }
+    return texture;
+}
+
+// The m_objText index of the texture at each path, loading those to
+// which no reference has been seen.
+std::vector<uint32_t> VkApp::loadTextures(const std::vector<std::string>& paths)
+{
+    // The files to load:  each new canonical path, once, in order
+    std::vector<std::string> canonical;
+    std::vector<std::string> files;
+    std::set<std::string> seen;
+    for (const std::string& path : paths) {
+        canonical.push_back(canonicalTexturePath(path));
+        if (m_textureByPath.count(canonical.back()) == 0 && seen.insert(canonical.back()).second)
+            files.push_back(canonical.back()); }
+
+    // Keep one decode per hardware thread in flight (and no more
+    // decoded images than that waiting in memory).  The flip is
+    // stb_image's global, so it is set here, before any decode.
+    stbi_set_flip_vertically_on_load(true);
+    size_t ahead = std::max(1u, std::thread::hardware_concurrency());
+    bool hash = app->hashTextures;
+    std::vector<std::future<DecodedTexture>> decoding(files.size());
+    size_t started = 0;
+    auto startDecodes = [&](size_t end) {
+        for (;  started < std::min(end, files.size());  started++)
+            decoding[started] = std::async(std::launch::async, decodeTexture, files[started], hash); };
+    startDecodes(ahead);
+
+    std::vector<uint32_t> indices;
+    size_t next = 0;  // Of files, the next to upload
+    for (const std::string& path : canonical) {
+        m_textureRefs++;
+        auto byPath = m_textureByPath.find(path);
+        if (byPath != m_textureByPath.end()) {
+            m_textureSharedByPath++;
+            m_textureBytesSaved += textureBytes(m_objText[byPath->second].extent);
+            indices.push_back(byPath->second);
+            continue; }
+
+        // A path not seen before is the next of files.
+        DecodedTexture texture = decoding[next++].get();
+        startDecodes(next + ahead);
+
+        // A key match is only likely a copy:  the first file's bytes
+        // are read again to be sure, rather than kept all along.
+        auto byContent = m_textureByContent.find(texture.content);
+        if (texture.content.first > 0 && byContent != m_textureByContent.end()) {
+            std::vector<unsigned char> first = readBytes(byContent->second.path);
+            if (first.size() == texture.bytes.size()
+                && std::memcmp(first.data(), texture.bytes.data(), first.size()) == 0) {
+                m_textureSharedByContent++;
+                m_textureBytesSaved += textureBytes(m_objText[byContent->second.index].extent);
+                m_textureByPath[path] = byContent->second.index;
+                indices.push_back(byContent->second.index);
+                continue; } }
+
+        uint32_t index = static_cast<uint32_t>(m_objText.size());
+        m_objText.push_back(readTextureFile(texture));
+        m_textureByPath[path] = index;
+        if (texture.content.first > 0 && byContent == m_textureByContent.end())
+            m_textureByContent[texture.content] = {index, path};
+        indices.push_back(index); }
+    return indices;
+}
+
+void VkApp::reportTextures()
+{
+    printf("textures: %d references, %zu loaded (%d shared by path, %d by content%s), "
+           "%.1f MB of device memory saved, %zu samplers\n",
+           m_textureRefs, m_objText.size(), m_textureSharedByPath, m_textureSharedByContent,
+           app->hashTextures ? "" : ":  off without -C", m_textureBytesSaved / (1024.0 * 1024.0),
+           m_samplers.size());
+}
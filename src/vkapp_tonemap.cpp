@@ -0,0 +1,196 @@
+//////////////////////////////////////////////////////////////////////
+// Auto-exposure and tone mapping.  Three compute passes turn the HDR
+// m_renderTarget, from either renderer, into the sRGB m_displayBuffer
+// that the post pass copies to the swapchain image:
+//   histogram.comp  log2 luminance histogram, binned in shared memory
+//   exposure.comp   the exposure, from the histogram, smoothed over time
+//   tonemap.comp    exposure, Hable's filmic curve, and sRGB encoding
+// The histogram and exposure live in the host-visible
+// m_tonemapStatsBuff, which is read after each frame's fence for a
+// once a second report (and, with the H key, the full histogram).
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define GROUP_SIZE 16
+
+void VkApp::createTonemapBuffers()
+{
+    VkImageUsageFlags flags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    initImageWrap(m_displayBuffer, m_windowSize, displayFormat, flags,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL);
+    initTextureSampler(m_displayBuffer);
+    NAME(m_displayBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_displayBuffer");
+
+    initBufferWrap(m_tonemapStatsBuff, sizeof(TonemapStats),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_tonemapStatsBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_tonemapStatsBuff");
+    vkMapMemory(m_device, m_tonemapStatsBuff.memory, 0, sizeof(TonemapStats), 0, (void**)&m_tonemapStats);
+    *m_tonemapStats = TonemapStats{};  // avgLum 0: the first frame sets the exposure outright
+
+    m_pcTonemap.width = m_windowSize.width;
+    m_pcTonemap.height = m_windowSize.height;
+    m_pcTonemap.minLogLum = -10.0f;
+    m_pcTonemap.logLumRange = 22.0f;  // log2 luminance -10 to 12
+    m_pcTonemap.exposure = 1.0f;
+    m_pcTonemap.autoExposure = app->autoExposure;
+}
+
+void VkApp::createTonemapDescriptorSet()
+{
+    m_tonemapDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+
+    m_tonemapDesc.write(m_device, 0, m_renderTarget.Descriptor());   // The HDR image
+    m_tonemapDesc.write(m_device, 1, m_displayBuffer.Descriptor());  // The post pass's input
+    m_tonemapDesc.write(m_device, 2, m_tonemapStatsBuff.buffer);
+}
+
+// The three passes share a layout and a descriptor set.
+void VkApp::createTonemapPipelines()
+{
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantTonemap)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.setLayoutCount = 1;
+    plCreateInfo.pSetLayouts = &m_tonemapDesc.descSetLayout;
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_tonemapPipelineLayout);
+
+    const char* shaders[] = {"spv/histogram.comp.spv", "spv/exposure.comp.spv", "spv/tonemap.comp.spv"};
+    VkPipeline* pipelines[] = {&m_histogramPipeline, &m_exposurePipeline, &m_tonemapPipeline};
+    for (int i = 0; i < 3; i++) {
+        VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+        cpCreateInfo.layout = m_tonemapPipelineLayout;
+        cpCreateInfo.stage = createShaderStageInfo(loadFile(shaders[i]), VK_SHADER_STAGE_COMPUTE_BIT);
+        double start = glfwGetTime();
+        vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, pipelines[i]);
+        logPipelineTime(shaders[i], start);
+        vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr); }
+}
+
+// Tone map m_renderTarget into m_displayBuffer.
+void VkApp::tonemap()
+{
+    readTonemapStats();  // Last frame's, before the histogram is cleared
+
+    // Adapt at a rate independent of the frame rate:  a time constant
+    // of about a second.
+    double now = glfwGetTime();
+    float dt = m_tonemapLastTime > 0.0 ? float(now - m_tonemapLastTime) : 0.0f;
+    m_tonemapLastTime = now;
+    m_pcTonemap.adaptRate = 1.0f - std::exp(-dt / 0.9f);
+    m_pcTonemap.autoExposure = app->autoExposure;
+
+    vkCmdFillBuffer(m_commandBuffer, m_tonemapStatsBuff.buffer,
+                    offsetof(TonemapStats, histogram), sizeof(uint) * TM_BINS, 0);
+
+    // Wait for the renderer's output, and for the clear
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+        | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+                         | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_tonemapPipelineLayout, 0, 1, &m_tonemapDesc.descSet, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_tonemapPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantTonemap), &m_pcTonemap);
+
+    // Each pass reads what the last one wrote.
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    // These MUST match the shaders' workgroup sizes
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_histogramPipeline);
+    vkCmdDispatch(m_commandBuffer, (m_windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  (m_windowSize.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_exposurePipeline);
+    vkCmdDispatch(m_commandBuffer, 1, 1, 1);
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_tonemapPipeline);
+    vkCmdDispatch(m_commandBuffer, (m_windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  (m_windowSize.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+
+    // The post pass samples the result;  the host reads the stats.
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+    m_tonemapStatsPending = true;
+}
+
+// The luminance below which the given fraction of the lit pixels lie,
+// from the histogram.
+float VkApp::tonemapPercentile(float fraction)
+{
+    const TonemapStats& stats = *m_tonemapStats;
+    float lit = float(stats.pixelCount - stats.histogram[0]);
+    float below = 0.0f;
+    for (int b = 1; b < TM_BINS; b++) {
+        below += stats.histogram[b];
+        if (below >= fraction * lit)
+            return std::exp2(m_pcTonemap.minLogLum
+                             + float(b) / TM_LOG_BINS * m_pcTonemap.logLumRange); }
+    return std::exp2(m_pcTonemap.minLogLum + m_pcTonemap.logLumRange);
+}
+
+// Read last frame's histogram and exposure, once its fence has
+// signaled, and report them once a second.
+void VkApp::readTonemapStats()
+{
+    if (!m_tonemapStatsPending)
+        return;
+    m_tonemapStatsPending = false;
+    const TonemapStats& stats = *m_tonemapStats;
+    if (stats.pixelCount == 0)
+        return;
+
+    if (app->dumpHistogram) {
+        app->dumpHistogram = false;
+        printf("Luminance histogram (%d pixels, log2 luminance %.1f to %.1f):\n",
+               stats.pixelCount, m_pcTonemap.minLogLum, m_pcTonemap.minLogLum + m_pcTonemap.logLumRange);
+        printf("  black: %d\n", stats.histogram[0]);
+        for (int b = 1; b < TM_BINS; b++)
+            if (stats.histogram[b] > 0)
+                printf("  %6.2f: %d\n", m_pcTonemap.minLogLum
+                       + (b - 0.5f) / TM_LOG_BINS * m_pcTonemap.logLumRange, stats.histogram[b]); }
+
+    double now = glfwGetTime();
+    if (m_tonemapReportStart == 0.0)
+        m_tonemapReportStart = now;
+    if (now - m_tonemapReportStart < 1.0)
+        return;
+    m_tonemapReportStart = now;
+
+    printf("Exposure: %.3f%s (scene luminance %.4f), luminance 5%%/50%%/95%%: %.4f/%.4f/%.4f, %.1f%% black\n",
+           stats.exposure, m_pcTonemap.autoExposure ? "" : " fixed", stats.avgLum,
+           tonemapPercentile(0.05f), tonemapPercentile(0.5f), tonemapPercentile(0.95f),
+           100.0f * stats.histogram[0] / stats.pixelCount);
+}
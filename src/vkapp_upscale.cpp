@@ -0,0 +1,174 @@
+//////////////////////////////////////////////////////////////////////
+// Spatial upscaling and dynamic resolution.  The path tracer's images
+// are allocated at m_maxRenderSize (app->renderScale, -r, of the
+// window size), and it renders into their top left m_renderSize.  With
+// -R, updateRenderSize varies m_renderSize from frame to frame to hold
+// the frame time near app->targetFrameMs.  With -U, upscale.comp
+// resizes the denoised image to the window size in place of the TAA
+// pass;  either way, sharpen.comp then sharpens the result into
+// m_renderTarget for the post pass.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+#define GROUP_SIZE 8
+
+void VkApp::createUpscaleBuffers()
+{
+    VkImageUsageFlags flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    initImageWrap(m_upscaleBuffer, m_windowSize, colorFormat, flags,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL);
+    NAME(m_upscaleBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_upscaleBuffer");
+    m_upscaleHandle = bindlessStorageImage(m_upscaleBuffer);
+}
+
+void VkApp::createUpscaleDescriptorSet()
+{
+    m_upscaleDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+
+    // Each pass's input, the denoised image or the upscaled one, is
+    // read by the handle in m_pcUpscale.
+    m_upscaleDesc.write(m_device, 0, m_upscaleBuffer.Descriptor()); // Upscaled, at the window size
+    m_upscaleDesc.write(m_device, 1, m_renderTarget.Descriptor());  // Sharpened, the post pass's input
+}
+
+// The upscaler and the sharpener share a layout and a descriptor set.
+void VkApp::createUpscalePipelines()
+{
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantUpscale)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    std::vector<VkDescriptorSetLayout> setLayouts = {m_upscaleDesc.descSetLayout,
+                                                     m_bindlessDesc.descSetLayout};
+    plCreateInfo.setLayoutCount = (uint32_t)setLayouts.size();
+    plCreateInfo.pSetLayouts = setLayouts.data();
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_upscalePipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_upscalePipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/upscale.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    double start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_upscalePipeline);
+    logPipelineTime("upscale", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/sharpen.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    start = glfwGetTime();
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_sharpenPipeline);
+    logPipelineTime("sharpen", start);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    m_pcUpscale.sharpness = 0.5f;
+    useSpatialUpscaler = app->useSpatialUpscaler;
+}
+
+// Choose the coming frame's render size.  The frame time is averaged
+// from the timestamps;  outside a band of 10% around the target, the
+// scale moves by the square root of the ratio (the trace's cost goes
+// with the pixel count), by at most 15% at a time.  After a change,
+// the history restarts, so the next one waits for the average to
+// settle.
+void VkApp::updateRenderSize()
+{
+    m_pcRay.prevWidth = m_renderSize.width;
+    m_pcRay.prevHeight = m_renderSize.height;
+    m_renderSizeChanged = false;
+    m_framesSinceResize++;
+
+    float frameMs = timestampMs(TS_FRAME_BEGIN, TS_FRAME_END);
+    if (app->dynamicResolution && frameMs > 0.0f) {
+        if (m_resizeFrameMs == 0.0f)
+            m_resizeFrameMs = frameMs;
+        else
+            m_resizeFrameMs = 0.9f*m_resizeFrameMs + 0.1f*frameMs;
+
+        float ratio = m_targetFrameMs / m_resizeFrameMs;
+        if (m_framesSinceResize >= 16 && (ratio < 0.9f || ratio > 1.1f)) {
+            float scale = m_renderScale * std::clamp(std::sqrt(ratio), 0.85f, 1.15f);
+            m_renderScale = std::clamp(scale, 0.25f, app->renderScale);
+
+            // Whole workgroups of 8x8, within the allocated images
+            VkExtent2D size;
+            size.width = std::clamp((uint32_t(m_windowSize.width * m_renderScale) + 7) & ~7u,
+                                    std::min(64u, m_maxRenderSize.width), m_maxRenderSize.width);
+            size.height = std::clamp((uint32_t(m_windowSize.height * m_renderScale) + 7) & ~7u,
+                                     std::min(64u, m_maxRenderSize.height), m_maxRenderSize.height);
+            if (size.width != m_renderSize.width || size.height != m_renderSize.height) {
+                m_renderSize = size;
+                m_renderSizeChanged = true;
+                m_taaReset = true;
+                m_framesSinceResize = 0;
+                printf("Render size: %dx%d of %dx%d (%.2f ms frame)\n",
+                       m_renderSize.width, m_renderSize.height,
+                       m_windowSize.width, m_windowSize.height, m_resizeFrameMs); } } }
+
+    m_pcRay.width = m_renderSize.width;
+    m_pcRay.height = m_renderSize.height;
+    m_pcUpscale.renderSize = glm::vec2(m_renderSize.width, m_renderSize.height);
+    m_pcTaa.renderSize = m_pcUpscale.renderSize;
+}
+
+// Resize the denoiser's output (at the render size) into
+// m_upscaleBuffer at the window size.
+void VkApp::upscale()
+{
+    // Wait for the denoiser's output
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_pcUpscale.inImage = m_denoiseOutput;
+    m_upscaleOutput = m_upscaleHandle;
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_upscalePipeline);
+    VkDescriptorSet sets[] = {m_upscaleDesc.descSet, m_bindlessDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_upscalePipelineLayout, 0, 2, sets, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_upscalePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantUpscale), &m_pcUpscale);
+    // This MUST match the shader's GROUP_SIZE
+    vkCmdDispatch(m_commandBuffer, (m_windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  (m_windowSize.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+}
+
+// Sharpen the output of upscale or taa into m_renderTarget.
+void VkApp::sharpen()
+{
+    m_pcUpscale.inImage = m_upscaleOutput;
+
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_sharpenPipeline);
+    VkDescriptorSet sets[] = {m_upscaleDesc.descSet, m_bindlessDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_upscalePipelineLayout, 0, 2, sets, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_upscalePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantUpscale), &m_pcUpscale);
+    // This MUST match the shader's GROUP_SIZE
+    vkCmdDispatch(m_commandBuffer, (m_windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  (m_windowSize.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+}
@@ -0,0 +1,247 @@
+//////////////////////////////////////////////////////////////////////
+// Hybrid rendering (-P, toggled with the P key):  the path tracer's
+// first ray from each pixel only finds what the pixel sees, which the
+// rasterizer finds far more cheaply.  So before tracing,
+// rasterizeVisibility draws every instance into a visibility buffer
+// at the render size, with the same jittered camera as the eye rays,
+// and visibility.frag writes each pixel's hit as a RayPayload would
+// hold it:  the instance and triangle, the distance from the eye, and
+// the barycentric coordinates.  PathTrace (and the wavefront tracer's
+// first extend) then takes the primary hit from the buffer in place
+// of tracing it, and starts the paths' bounces from there.
+//
+// The rays/s and frame rate reports of reportTraceRate name the mode,
+// so it can be compared with pure path tracing by toggling.
+////////////////////////////////////////////////////////////////////////
+
+#include <array>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+void VkApp::createVisibilityBuffers()
+{
+    VkImageUsageFlags flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    initImageWrap(m_visibilityBuffer, m_maxRenderSize, visibilityFormat, flags,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL);
+    NAME(m_visibilityBuffer.image, VK_OBJECT_TYPE_IMAGE, "m_visibilityBuffer");
+
+    // Its own depth, as the window-sized m_depthImage may be smaller
+    // than the render size.
+    initImageWrap(m_visibilityDepth, m_maxRenderSize, VK_FORMAT_X8_D24_UNORM_PACK32,
+                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_DEPTH_BIT,
+                  VK_IMAGE_LAYOUT_UNDEFINED);
+    NAME(m_visibilityDepth.image, VK_OBJECT_TYPE_IMAGE, "m_visibilityDepth");
+
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.format = visibilityFormat;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentDescription depthAttachment = colorAttachment;
+    depthAttachment.format = VK_FORMAT_X8_D24_UNORM_PACK32;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorAttachmentRef{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkAttachmentReference depthAttachmentRef{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    // Last frame's tracer must be done reading the buffer before it
+    // is drawn over, and this frame's waits for the drawing.
+    VkSubpassDependency before{};
+    before.srcSubpass = VK_SUBPASS_EXTERNAL;
+    before.dstSubpass = 0;
+    before.srcStageMask = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    before.srcAccessMask = 0;
+    before.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    before.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkSubpassDependency after{};
+    after.srcSubpass = 0;
+    after.dstSubpass = VK_SUBPASS_EXTERNAL;
+    after.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    after.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    after.dstStageMask = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    after.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    std::array<VkSubpassDependency, 2> dependencies = {before, after};
+    std::array<VkAttachmentDescription, 2> attachmentsDsc = {colorAttachment, depthAttachment};
+    VkRenderPassCreateInfo renderPassInfo{VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentsDsc.size());
+    renderPassInfo.pAttachments = attachmentsDsc.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+    vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_visibilityRenderPass);
+
+    std::vector<VkImageView> attachments = {m_visibilityBuffer.imageView, m_visibilityDepth.imageView};
+    VkFramebufferCreateInfo info{VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+    info.renderPass      = m_visibilityRenderPass;
+    info.attachmentCount = attachments.size();
+    info.pAttachments    = attachments.data();
+    info.width           = m_maxRenderSize.width;
+    info.height          = m_maxRenderSize.height;
+    info.layers          = 1;
+    vkCreateFramebuffer(m_device, &info, nullptr, &m_visibilityFramebuffer);
+}
+
+// As createScPipeline's, but for visibility.frag, and with the
+// viewport set per frame to the render size.
+void VkApp::createVisibilityPipeline()
+{
+    VkPushConstantRange pushConstantRange = {
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantRaster)};
+
+    VkPipelineLayoutCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    createInfo.setLayoutCount         = 1;
+    createInfo.pSetLayouts            = &m_scDesc.descSetLayout;
+    createInfo.pushConstantRangeCount = 1;
+    createInfo.pPushConstantRanges    = &pushConstantRange;
+    if (vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_visibilityPipelineLayout) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create pipeline layout!");
+    }
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {
+        createShaderStageInfo(loadFile("spv/scanline.vert.spv"), VK_SHADER_STAGE_VERTEX_BIT),
+        createShaderStageInfo(loadFile("spv/visibility.frag.spv"), VK_SHADER_STAGE_FRAGMENT_BIT)};
+
+    VkVertexInputBindingDescription bindingDescription
+        {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX};
+
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions {
+        {0, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, pos))},
+        {1, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, nrm))},
+        {2, 0, VK_FORMAT_R32G32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, texCoord))}};
+
+    VkPipelineVertexInputStateCreateInfo
+        vertexInputInfo{VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+    VkPipelineInputAssemblyStateCreateInfo
+        inputAssembly{VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo
+        viewportState{VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState{VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicState.pDynamicStates = dynamicStates.data();
+
+    // Both faces, as the rays see them.
+    VkPipelineRasterizationStateCreateInfo
+        rasterizer{VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo
+        multisampling{VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo
+        depthStencil{VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo
+        colorBlending{VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = m_visibilityPipelineLayout;
+    pipelineInfo.renderPass = m_visibilityRenderPass;
+    pipelineInfo.subpass = 0;
+
+    double start = glfwGetTime();
+    if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_visibilityPipeline) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create graphics pipeline!");
+    }
+    logPipelineTime("visibility", start);
+
+    vkDestroyShaderModule(m_device, shaderStages[0].module, nullptr);
+    vkDestroyShaderModule(m_device, shaderStages[1].module, nullptr);
+}
+
+// Draw every instance into m_visibilityBuffer, over m_renderSize.  A
+// pixel with no hit keeps the cleared distance of 0.
+void VkApp::rasterizeVisibility()
+{
+    std::array<VkClearValue, 2> clearValues{};
+    clearValues[0].color.uint32[0] = 0;
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo beginInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+    beginInfo.clearValueCount = 2;
+    beginInfo.pClearValues    = clearValues.data();
+    beginInfo.renderPass      = m_visibilityRenderPass;
+    beginInfo.framebuffer     = m_visibilityFramebuffer;
+    beginInfo.renderArea      = {{0, 0}, m_renderSize};
+    vkCmdBeginRenderPass(m_commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkViewport viewport{0.0f, 0.0f, float(m_renderSize.width), float(m_renderSize.height), 0.0f, 1.0f};
+    vkCmdSetViewport(m_commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(m_commandBuffer, 0, 1, &beginInfo.renderArea);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_visibilityPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_visibilityPipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
+
+    VkDeviceSize offset{0};
+    for (const ObjInst& inst : m_objInst) {
+        auto& object = m_objData[inst.objIndex];
+        PushConstantRaster pcRaster{scLightPos, scLightInt, scLightAmb, inst.transform, inst.objIndex};
+        vkCmdPushConstants(m_commandBuffer, m_visibilityPipelineLayout,
+                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(PushConstantRaster), &pcRaster);
+        vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, &object.vertexBuffer.buffer, &offset);
+        vkCmdBindIndexBuffer(m_commandBuffer, object.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexed(m_commandBuffer, object.nbIndices, 1, 0, 0, 0); }
+
+    vkCmdEndRenderPass(m_commandBuffer);
+}
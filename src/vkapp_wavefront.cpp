@@ -0,0 +1,308 @@
+//////////////////////////////////////////////////////////////////////
+// Wavefront path tracer.  Instead of one thread running a whole path
+// (the megakernel of raytrace.rgen and raytrace.comp), each step of
+// the path tracing loop is its own compute pass over a queue of
+// paths: generate, then per bounce extend (trace), sort by material,
+// shade (and queue a shadow ray), and trace the shadow rays; finally
+// resolve the paths into the accumulation buffers.  Terminated paths
+// drop out of the queues, so lanes are not left idle by divergent
+// path lengths.  Selected at startup with -w; reports per stage GPU
+// time and lane utilization to compare with the megakernel's.
+////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+static const char* wfStageNames[] = {
+    "generate", "extend", "sort", "scatter", "shade", "shadow", "resolve" };
+
+// A timestamp before the first stage, then one after each stage.
+static const uint32_t wfTimestampCount = 3 + 5*WF_MAX_BOUNCES;
+
+void VkApp::createWfBuffers()
+{
+    // One path, hit, and queue entry per pixel.
+    VkDeviceSize pathCount = m_maxRenderSize.width * m_maxRenderSize.height;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkMemoryPropertyFlags mem = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+    initBufferWrap(m_wfPathBuff, pathCount*sizeof(WfPath), usage, mem);
+    NAME(m_wfPathBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfPathBuff");
+    initBufferWrap(m_wfHitBuff, pathCount*sizeof(WfHit), usage, mem);
+    NAME(m_wfHitBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfHitBuff");
+    initBufferWrap(m_wfFirstHitBuff, pathCount*sizeof(WfFirstHit), usage, mem);
+    NAME(m_wfFirstHitBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfFirstHitBuff");
+    initBufferWrap(m_wfQueueBuff[0], pathCount*sizeof(uint32_t), usage, mem);
+    NAME(m_wfQueueBuff[0].buffer, VK_OBJECT_TYPE_BUFFER, "m_wfQueueBuff[0]");
+    initBufferWrap(m_wfQueueBuff[1], pathCount*sizeof(uint32_t), usage, mem);
+    NAME(m_wfQueueBuff[1].buffer, VK_OBJECT_TYPE_BUFFER, "m_wfQueueBuff[1]");
+    initBufferWrap(m_wfSortedBuff, pathCount*sizeof(uint32_t), usage, mem);
+    NAME(m_wfSortedBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfSortedBuff");
+    initBufferWrap(m_wfShadowBuff, pathCount*sizeof(WfShadowRay), usage, mem);
+    NAME(m_wfShadowBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfShadowBuff");
+
+    // The counters double as indirect dispatch arguments, and are
+    // reset between stages by transfers.
+    initBufferWrap(m_wfCounterBuff, sizeof(WfCounters),
+                   usage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                   | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, mem);
+    NAME(m_wfCounterBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfCounterBuff");
+    // A bin for each of the scene's materials, so that the sort never
+    // mixes two of them.
+    m_wfBins = WF_BINS;
+    while (m_wfBins < m_materialCount)
+        m_wfBins *= 2;
+    printf("Wavefront: %u materials in %u bins\n", m_materialCount, m_wfBins);
+    initBufferWrap(m_wfBinBuff, m_wfBins*sizeof(uint32_t),
+                   usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, mem);
+    NAME(m_wfBinBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfBinBuff");
+
+    // Each bounce's counters are copied out for the host to read after
+    // the frame's fence.
+    initBufferWrap(m_wfStatsBuff, WF_MAX_BOUNCES*sizeof(WfCounters),
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_wfStatsBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_wfStatsBuff");
+    vkMapMemory(m_device, m_wfStatsBuff.memory, 0, WF_MAX_BOUNCES*sizeof(WfCounters), 0,
+                (void**)&m_wfStats);
+
+    VkQueryPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    poolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = wfTimestampCount;
+    if (vkCreateQueryPool(m_device, &poolInfo, nullptr, &m_wfTimestampPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create wavefront timestamp query pool!"); }
+    NAME(m_wfTimestampPool, VK_OBJECT_TYPE_QUERY_POOL, "m_wfTimestampPool");
+}
+
+void VkApp::createWfDescriptorSet()
+{
+    m_wfDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+
+    DescriptorBatch batch;
+    batch.write(m_wfDesc, 0, m_wfPathBuff.buffer);
+    batch.write(m_wfDesc, 1, m_wfHitBuff.buffer);
+    batch.write(m_wfDesc, 2, m_wfFirstHitBuff.buffer);
+    batch.write(m_wfDesc, 3, m_wfQueueBuff[0].buffer);
+    batch.write(m_wfDesc, 4, m_wfQueueBuff[1].buffer);
+    batch.write(m_wfDesc, 5, m_wfSortedBuff.buffer);
+    batch.write(m_wfDesc, 6, m_wfShadowBuff.buffer);
+    batch.write(m_wfDesc, 7, m_wfCounterBuff.buffer);
+    batch.write(m_wfDesc, 8, m_wfBinBuff.buffer);
+    batch.flush(m_device);
+}
+
+// One pipeline per stage, all from wavefront.comp, specialized by
+// the stage, its workgroup size, and the bin count.
+void VkApp::createWfPipelines()
+{
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantRay)};
+    std::vector<VkDescriptorSetLayout> wfDescSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout, m_wfDesc.descSetLayout,
+         m_bindlessDesc.descSetLayout};
+
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.setLayoutCount = static_cast<uint32_t>(wfDescSetLayouts.size());
+    plCreateInfo.pSetLayouts = wfDescSetLayouts.data();
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_wfPipelineLayout);
+
+    VkPipelineShaderStageCreateInfo stageInfo =
+        createShaderStageInfo(loadFile("spv/wavefront.comp.spv"), VK_SHADER_STAGE_COMPUTE_BIT);
+
+    struct { int32_t stage; uint32_t groupSize; uint32_t bins; } specData;
+    std::vector<VkSpecializationMapEntry> specEntries = {
+        {0, offsetof(decltype(specData), stage), sizeof(int32_t)},
+        {1, offsetof(decltype(specData), groupSize), sizeof(uint32_t)},
+        {2, offsetof(decltype(specData), bins), sizeof(uint32_t)} };
+    VkSpecializationInfo specInfo{};
+    specInfo.mapEntryCount = static_cast<uint32_t>(specEntries.size());
+    specInfo.pMapEntries = specEntries.data();
+    specInfo.dataSize = sizeof(specData);
+    specInfo.pData = &specData;
+    stageInfo.pSpecializationInfo = &specInfo;
+
+    // The sort's single workgroup has a thread per bin where the device
+    // allows, up to WF_BINS;  otherwise each thread scans a run of
+    // bins.  m_wfBins is a power of two, so any power of two below it
+    // divides it.
+    uint32_t sortGroupSize = WF_BINS;
+    while (sortGroupSize > m_deviceProperties.limits.maxComputeWorkGroupInvocations
+           || sortGroupSize > m_deviceProperties.limits.maxComputeWorkGroupSize[0])
+        sortGroupSize /= 2;
+
+    for (int stage = 0; stage < WF_STAGE_COUNT; stage++) {
+        specData.stage = stage;
+        specData.groupSize = stage == WF_SORT ? sortGroupSize : WF_GROUP_SIZE;
+        specData.bins = m_wfBins;
+
+        VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+        cpCreateInfo.layout = m_wfPipelineLayout;
+        cpCreateInfo.stage = stageInfo;
+        double start = glfwGetTime();
+        vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_wfPipelines[stage]);
+        logPipelineTime(wfStageNames[stage], start);
+        NAME(m_wfPipelines[stage], VK_OBJECT_TYPE_PIPELINE, wfStageNames[stage]); }
+
+    vkDestroyShaderModule(m_device, stageInfo.module, nullptr);
+}
+
+// Record one frame of the wavefront tracer over the whole screen, in
+// place of the megakernel's dispatch.  The caller has set m_pcRay.
+void VkApp::wavefront()
+{
+    VkCommandBuffer cmd = m_commandBuffer;
+    uint32_t pathCount = m_renderSize.width * m_renderSize.height;
+    uint32_t pathGroups = (pathCount + WF_GROUP_SIZE - 1) / WF_GROUP_SIZE;
+    int bounces = std::min(m_pcRay.depth, WF_MAX_BOUNCES);
+
+    // Every stage waits for all the previous ones:  for their queues,
+    // their indirect arguments, and the counter resets.
+    auto stageBarrier = [&]() {
+        VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+            | VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+            | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+                             | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr); };
+
+    // An empty queue:  no items, and no workgroups to dispatch over them.
+    WfQueue emptyQueue{0, 1, 1, 0};
+    auto resetQueue = [&](VkDeviceSize offset) {
+        vkCmdUpdateBuffer(cmd, m_wfCounterBuff.buffer, offset, sizeof(WfQueue), &emptyQueue); };
+    VkDeviceSize pathsOffset[2] = { offsetof(WfCounters, paths),
+                                    offsetof(WfCounters, paths) + sizeof(WfQueue) };
+
+    uint32_t timestamp = 0;
+    m_wfTimedStages.clear();
+    auto runStage = [&](WfStage stage) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_wfPipelines[stage]);
+        if (stage == WF_GENERATE || stage == WF_RESOLVE)
+            vkCmdDispatch(cmd, pathGroups, 1, 1);
+        else if (stage == WF_SORT)
+            vkCmdDispatch(cmd, 1, 1, 1);
+        else if (stage == WF_SHADE)
+            vkCmdDispatchIndirect(cmd, m_wfCounterBuff.buffer, offsetof(WfCounters, shade));
+        else if (stage == WF_SHADOW)
+            vkCmdDispatchIndirect(cmd, m_wfCounterBuff.buffer, offsetof(WfCounters, shadow));
+        else  // Extend and scatter run over this bounce's path queue
+            vkCmdDispatchIndirect(cmd, m_wfCounterBuff.buffer, pathsOffset[m_pcRay.wfBounce & 1]);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                            m_wfTimestampPool, ++timestamp);
+        m_wfTimedStages.push_back(stage);
+        stageBarrier(); };
+
+    vkCmdResetQueryPool(cmd, m_wfTimestampPool, 0, wfTimestampCount);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_wfTimestampPool, timestamp);
+
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet, m_wfDesc.descSet,
+                                          m_bindlessDesc.descSet};
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_wfPipelineLayout, 0,
+                            descSets.size(), descSets.data(), 0, nullptr);
+
+    m_pcRay.wfBounce = 0;
+    vkCmdPushConstants(cmd, m_wfPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantRay), &m_pcRay);
+    resetQueue(pathsOffset[0]);
+    stageBarrier();
+    runStage(WF_GENERATE);
+
+    for (int bounce = 0; bounce < bounces; bounce++) {
+        m_pcRay.wfBounce = bounce;
+        vkCmdPushConstants(cmd, m_wfPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(PushConstantRay), &m_pcRay);
+
+        // Shade fills the other path queue with the paths that go on.
+        resetQueue(pathsOffset[1 - (bounce & 1)]);
+        resetQueue(offsetof(WfCounters, shade));
+        resetQueue(offsetof(WfCounters, shadow));
+        vkCmdFillBuffer(cmd, m_wfBinBuff.buffer, 0, m_wfBins*sizeof(uint32_t), 0);
+        stageBarrier();
+
+        runStage(WF_EXTEND);
+        runStage(WF_SORT);
+        runStage(WF_SCATTER);
+        runStage(WF_SHADE);
+        runStage(WF_SHADOW);
+
+        VkBufferCopy region{0, bounce*sizeof(WfCounters), sizeof(WfCounters)};
+        vkCmdCopyBuffer(cmd, m_wfCounterBuff.buffer, m_wfStatsBuff.buffer, 1, &region);
+        stageBarrier(); }
+
+    runStage(WF_RESOLVE);
+    m_wfBounces = bounces;
+
+    // The counter copies are read by the host after the frame's fence.
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Fold the last traced frame's stage times and queue counters into
+// the report window.  Lane utilization of a queue driven stage is its
+// items over the lanes of the workgroups dispatched for them.
+void VkApp::readWavefrontStats()
+{
+    if (m_wfBounces == 0)
+        return;
+
+    uint32_t count = uint32_t(m_wfTimedStages.size()) + 1;
+    std::vector<uint64_t> results(2*count, 0);
+    vkGetQueryPoolResults(m_device, m_wfTimestampPool, 0, count,
+                          results.size()*sizeof(uint64_t), results.data(), 2*sizeof(uint64_t),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    for (uint32_t i = 1; i < count; i++) {
+        if (results[2*i+1] && results[2*i-1])
+            m_wfReportMs[m_wfTimedStages[i-1]] +=
+                double(results[2*i] - results[2*i-2]) * m_timestampPeriod * 1e-6; }
+
+    for (int bounce = 0; bounce < m_wfBounces; bounce++) {
+        const WfCounters& c = m_wfStats[bounce];
+        const WfQueue& paths = c.paths[bounce & 1];
+        m_wfReportItems[WF_EXTEND] += paths.count;
+        m_wfReportLanes[WF_EXTEND] += paths.groupsX * WF_GROUP_SIZE;
+        m_wfReportItems[WF_SCATTER] += paths.count;
+        m_wfReportLanes[WF_SCATTER] += paths.groupsX * WF_GROUP_SIZE;
+        m_wfReportItems[WF_SHADE] += c.shade.count;
+        m_wfReportLanes[WF_SHADE] += c.shade.groupsX * WF_GROUP_SIZE;
+        m_wfReportItems[WF_SHADOW] += c.shadow.count;
+        m_wfReportLanes[WF_SHADOW] += c.shadow.groupsX * WF_GROUP_SIZE; }
+
+    m_wfBounces = 0;
+}
+
+// Print the report window's average time per frame of each stage,
+// and lane utilization of the queue driven ones, then reset it.
+void VkApp::reportWavefront(int frames)
+{
+    for (int stage = 0; stage < WF_STAGE_COUNT; stage++) {
+        printf("  %-8s %6.3f ms", wfStageNames[stage], frames > 0 ? m_wfReportMs[stage] / frames : 0.0);
+        if (m_wfReportLanes[stage] > 0)
+            printf(", %.0f%% lane utilization", 100.0 * m_wfReportItems[stage] / m_wfReportLanes[stage]);
+        printf("\n");
+        m_wfReportMs[stage] = 0.0;
+        m_wfReportItems[stage] = 0;
+        m_wfReportLanes[stage] = 0; }
+}